@@ -0,0 +1,264 @@
+#include <algorithm>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "src/tQuicConnectedWriter.hh"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+using namespace quic;
+
+namespace nginx {
+
+std::unique_ptr<tQuicConnectedWriter> tQuicConnectedWriter::Create(
+    const QuicSocketAddress& self_address,
+    const QuicSocketAddress& peer_address,
+    tQuicStackStats* stats) {
+  sockaddr_storage self_ss = self_address.generic_address();
+  sockaddr_storage peer_ss = peer_address.generic_address();
+  if (self_ss.ss_family != peer_ss.ss_family ||
+      (self_ss.ss_family != AF_INET && self_ss.ss_family != AF_INET6)) {
+    return nullptr;
+  }
+  socklen_t len = self_ss.ss_family == AF_INET6 ? sizeof(sockaddr_in6)
+                                                : sizeof(sockaddr_in);
+
+  int fd = socket(self_ss.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  IPPROTO_UDP);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  int on = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+      bind(fd, reinterpret_cast<sockaddr*>(&self_ss), len) < 0 ||
+      connect(fd, reinterpret_cast<sockaddr*>(&peer_ss), len) < 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  return std::unique_ptr<tQuicConnectedWriter>(new tQuicConnectedWriter(fd, stats));
+}
+
+tQuicConnectedWriter::tQuicConnectedWriter(int fd, tQuicStackStats* stats)
+    : fd_(fd),
+      write_blocked_(false),
+      gso_disabled_(false),
+      stats_(stats),
+      buffered_bytes_(0),
+      segment_size_(0),
+      num_segments_(0) {}
+
+tQuicConnectedWriter::~tQuicConnectedWriter() {
+  close(fd_);
+}
+
+WriteResult tQuicConnectedWriter::WritePacket(
+    const char* buffer,
+    size_t buf_len,
+    const QuicIpAddress& /*self_address*/,
+    const QuicSocketAddress& /*peer_address*/,
+    PerPacketOptions* /*options*/) {
+  QUICHE_DCHECK(!write_blocked_);
+  QUICHE_DCHECK_LE(buf_len, kMaxOutgoingPacketSize);
+
+  if (!CanBatch(buf_len)) {
+    WriteResult result = Flush();
+    if (result.status != WRITE_STATUS_OK) {
+      // The packet was not buffered, the connection writes it again later.
+      return result;
+    }
+  }
+
+  // The packet may have been serialized in place by GetNextWriteLocation(),
+  // possibly ahead of a batch that has just been flushed.
+  char* location = buffer_ + buffered_bytes_;
+  if (buffer != location) {
+    memmove(location, buffer, buf_len);
+  }
+  if (num_segments_ == 0) {
+    segment_size_ = buf_len;
+  }
+  buffered_bytes_ += buf_len;
+  num_segments_++;
+
+  // A short packet can only be the last GSO segment.
+  if (buf_len < segment_size_ || num_segments_ == kMaxGsoSegments ||
+      kMaxGsoBytes - buffered_bytes_ < segment_size_) {
+    WriteResult result = Flush();
+    if (result.status == WRITE_STATUS_BLOCKED) {
+      return WriteResult(WRITE_STATUS_BLOCKED_DATA_BUFFERED, 0);
+    }
+    return result;
+  }
+
+  return WriteResult(WRITE_STATUS_OK, 0);
+}
+
+bool tQuicConnectedWriter::CanBatch(size_t buf_len) const {
+  if (num_segments_ == 0) {
+    return true;
+  }
+  return buf_len <= segment_size_ && buffered_bytes_ + buf_len <= kMaxGsoBytes;
+}
+
+bool tQuicConnectedWriter::IsWriteBlocked() const {
+  return write_blocked_;
+}
+
+void tQuicConnectedWriter::SetWritable() {
+  write_blocked_ = false;
+}
+
+QuicByteCount tQuicConnectedWriter::GetMaxPacketSize(
+    const QuicSocketAddress& /*peer_address*/) const {
+  return kMaxOutgoingPacketSize;
+}
+
+bool tQuicConnectedWriter::SupportsReleaseTime() const {
+  return false;
+}
+
+bool tQuicConnectedWriter::IsBatchMode() const {
+  return true;
+}
+
+char* tQuicConnectedWriter::GetNextWriteLocation(
+    const QuicIpAddress& /*self_address*/,
+    const QuicSocketAddress& /*peer_address*/) {
+  if (kMaxGsoBytes - buffered_bytes_ < kMaxOutgoingPacketSize) {
+    return nullptr;
+  }
+  return buffer_ + buffered_bytes_;
+}
+
+WriteResult tQuicConnectedWriter::Flush() {
+  if (num_segments_ == 0) {
+    return WriteResult(WRITE_STATUS_OK, 0);
+  }
+  if (gso_disabled_ || num_segments_ == 1) {
+    return FlushWithoutGso();
+  }
+
+  struct iovec iov;
+  iov.iov_base = buffer_;
+  iov.iov_len  = buffered_bytes_;
+
+  char control[CMSG_SPACE(sizeof(uint16_t))];
+  memset(control, 0, sizeof(control));
+
+  // No msg_name: the connected route is used as is.
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type  = UDP_SEGMENT;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+  uint16_t gso_size = static_cast<uint16_t>(segment_size_);
+  memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+
+  ssize_t rc;
+  do {
+    rc = sendmsg(fd_, &msg, 0);
+  } while (rc < 0 && errno == EINTR);
+
+  if (rc < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      write_blocked_ = true;
+      return WriteResult(WRITE_STATUS_BLOCKED, errno);
+    }
+    if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT) {
+      // Kernel or device without UDP GSO, stay on plain sends from now on.
+      gso_disabled_ = true;
+      return FlushWithoutGso();
+    }
+    int error = errno;
+    buffered_bytes_ = 0;
+    num_segments_ = 0;
+    return WriteResult(WRITE_STATUS_ERROR, error);
+  }
+
+  stats_->connected_udp_packets += num_segments_;
+  stats_->connected_udp_syscalls++;
+
+  size_t bytes_written = buffered_bytes_;
+  buffered_bytes_ = 0;
+  num_segments_ = 0;
+  return WriteResult(WRITE_STATUS_OK, bytes_written);
+}
+
+void tQuicConnectedWriter::MoveBufferedTo(
+    QuicPacketWriter* writer,
+    const QuicIpAddress& self_address,
+    const QuicSocketAddress& peer_address) {
+  size_t offset = 0;
+  while (offset < buffered_bytes_ && !writer->IsWriteBlocked()) {
+    size_t len = std::min(segment_size_, buffered_bytes_ - offset);
+    WriteResult result = writer->WritePacket(buffer_ + offset, len,
+                                             self_address, peer_address,
+                                             nullptr);
+    if (result.status == WRITE_STATUS_BLOCKED || IsWriteError(result.status)) {
+      break;
+    }
+    offset += len;
+  }
+  writer->Flush();
+
+  buffered_bytes_ = 0;
+  num_segments_ = 0;
+}
+
+WriteResult tQuicConnectedWriter::FlushWithoutGso() {
+  size_t offset = 0;
+  size_t bytes_written = 0;
+
+  while (offset < buffered_bytes_) {
+    size_t len = std::min(segment_size_, buffered_bytes_ - offset);
+    ssize_t rc;
+    do {
+      rc = send(fd_, buffer_ + offset, len, 0);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0) {
+      int error = errno;
+      if (error == EAGAIN || error == EWOULDBLOCK) {
+        // Keep the unsent tail for the next flush.
+        write_blocked_ = true;
+        memmove(buffer_, buffer_ + offset, buffered_bytes_ - offset);
+        buffered_bytes_ -= offset;
+        num_segments_ -= offset / segment_size_;
+        return WriteResult(WRITE_STATUS_BLOCKED, error);
+      }
+      buffered_bytes_ = 0;
+      num_segments_ = 0;
+      return WriteResult(WRITE_STATUS_ERROR, error);
+    }
+
+    stats_->connected_udp_packets++;
+    stats_->connected_udp_syscalls++;
+    offset += len;
+    bytes_written += len;
+  }
+
+  buffered_bytes_ = 0;
+  num_segments_ = 0;
+  return WriteResult(WRITE_STATUS_OK, bytes_written);
+}
+
+}  // namespace nginx
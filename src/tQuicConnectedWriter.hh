@@ -0,0 +1,83 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack connected UDP socket writer class.
+
+#ifndef _NGINX_T_QUIC_CONNECTED_WRITER_H_
+#define _NGINX_T_QUIC_CONNECTED_WRITER_H_
+
+#include <cstddef>
+#include <memory>
+
+#include "quic/core/quic_packet_writer.h"
+#include "quic/platform/api/quic_socket_address.h"
+#include "src/quic_stack_api.h"
+
+namespace nginx {
+
+// Writer owning a UDP socket connected to a single peer. Packets are sent
+// without destination address or IP_PKTINFO so the kernel reuses the cached
+// route, and consecutive packets are coalesced into one UDP GSO send.
+class tQuicConnectedWriter : public quic::QuicPacketWriter {
+ public:
+  // Opens a socket bound to |self_address| and connected to |peer_address|,
+  // returns nullptr on failure. The socket only sets SO_REUSEADDR so that it
+  // stays out of the listener's SO_REUSEPORT group.
+  static std::unique_ptr<tQuicConnectedWriter> Create(
+      const quic::QuicSocketAddress& self_address,
+      const quic::QuicSocketAddress& peer_address,
+      tQuicStackStats* stats);
+
+  tQuicConnectedWriter(const tQuicConnectedWriter&) = delete;
+  tQuicConnectedWriter& operator=(const tQuicConnectedWriter&) = delete;
+  ~tQuicConnectedWriter() override;
+
+  // QuicPacketWriter
+  quic::WriteResult WritePacket(const char* buffer,
+                          size_t buf_len,
+                          const quic::QuicIpAddress& self_address,
+                          const quic::QuicSocketAddress& peer_address,
+                          quic::PerPacketOptions* options) override;
+  bool IsWriteBlocked() const override;
+  void SetWritable() override;
+  quic::QuicByteCount GetMaxPacketSize(
+      const quic::QuicSocketAddress& peer_address) const override;
+  bool SupportsReleaseTime() const override;
+  bool IsBatchMode() const override;
+  char* GetNextWriteLocation(const quic::QuicIpAddress& self_address,
+                             const quic::QuicSocketAddress& peer_address) override;
+  quic::WriteResult Flush() override;
+
+  int fd() const { return fd_; }
+
+  // Hands the packets still held to |writer|, for a connection leaving this
+  // socket while it is blocked. Whatever |writer| does not take is dropped.
+  void MoveBufferedTo(quic::QuicPacketWriter* writer,
+                      const quic::QuicIpAddress& self_address,
+                      const quic::QuicSocketAddress& peer_address);
+
+ private:
+  // Kernel limits for one UDP GSO send.
+  static const size_t kMaxGsoSegments = 64;
+  static const size_t kMaxGsoBytes = 64 * 1024 - 1;
+
+  tQuicConnectedWriter(int fd, tQuicStackStats* stats);
+
+  // Whether a packet of |buf_len| bytes can join the pending batch.
+  bool CanBatch(size_t buf_len) const;
+
+  // Sends the batch segment by segment when the device refused GSO.
+  quic::WriteResult FlushWithoutGso();
+
+  int fd_;
+  bool write_blocked_;
+  bool gso_disabled_;
+  tQuicStackStats* stats_;
+
+  size_t buffered_bytes_;
+  size_t segment_size_;
+  size_t num_segments_;
+  char buffer_[kMaxGsoBytes];
+};
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_CONNECTED_WRITER_H_
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <string>
+
+#include "src/tQuicConnectionLimiter.hh"
+
+using namespace quic;
+
+namespace nginx {
+
+tQuicConnectionLimiter::tQuicConnectionLimiter()
+  : max_connections_(0),
+    max_per_prefix_(0),
+    ipv4_prefix_len_(32),
+    ipv6_prefix_len_(64)
+{
+}
+
+void tQuicConnectionLimiter::SetLimits(
+    uint64_t max_connections,
+    uint32_t max_per_prefix,
+    uint8_t ipv4_prefix_len,
+    uint8_t ipv6_prefix_len)
+{
+  max_connections_ = max_connections;
+  max_per_prefix_ = max_per_prefix;
+
+  // Counters are keyed by the prefix, a new length only applies to
+  // prefixes counted from now on.
+  if (ipv4_prefix_len > 0) {
+    ipv4_prefix_len_ = std::min<uint8_t>(ipv4_prefix_len, 32);
+  }
+  if (ipv6_prefix_len > 0) {
+    ipv6_prefix_len_ = std::min<uint8_t>(ipv6_prefix_len, 128);
+  }
+}
+
+uint64_t tQuicConnectionLimiter::PrefixKey(const QuicSocketAddress& peer) const
+{
+  QuicIpAddress host = peer.host().Normalized();
+  std::string packed = host.ToPackedString();
+  size_t prefix_len = host.IsIPv4() ? ipv4_prefix_len_ : ipv6_prefix_len_;
+
+  // FNV-1a over the masked bytes, the family and length go in first.
+  uint64_t key = 14695981039346656037ull;
+  key = (key ^ packed.size()) * 1099511628211ull;
+  key = (key ^ prefix_len) * 1099511628211ull;
+  for (size_t i = 0; i < packed.size() && i * 8 < prefix_len; i++) {
+    uint8_t byte = static_cast<uint8_t>(packed[i]);
+    if (prefix_len < (i + 1) * 8) {
+      byte &= static_cast<uint8_t>(0xff << ((i + 1) * 8 - prefix_len));
+    }
+    key = (key ^ byte) * 1099511628211ull;
+  }
+  return key;
+}
+
+tQuicConnectionLimiter::Verdict
+tQuicConnectionLimiter::Check(const QuicSocketAddress& peer) const
+{
+  if (max_connections_ > 0 && connections_.size() >= max_connections_) {
+    return CONNECTION_OVER_TOTAL;
+  }
+  if (max_per_prefix_ > 0) {
+    auto it = prefixes_.find(PrefixKey(peer));
+    if (it != prefixes_.end() && it->second >= max_per_prefix_) {
+      return CONNECTION_OVER_PREFIX;
+    }
+  }
+  return CONNECTION_ACCEPTED;
+}
+
+void tQuicConnectionLimiter::OnConnectionCreated(
+    const QuicConnectionId& connection_id,
+    const QuicSocketAddress& peer)
+{
+  uint64_t key = PrefixKey(peer);
+  if (connections_.emplace(connection_id, key).second) {
+    prefixes_[key]++;
+  }
+}
+
+void tQuicConnectionLimiter::OnConnectionClosed(const QuicConnectionId& connection_id)
+{
+  auto it = connections_.find(connection_id);
+  if (it == connections_.end()) {
+    return;
+  }
+
+  auto prefix = prefixes_.find(it->second);
+  if (prefix != prefixes_.end() && --prefix->second == 0) {
+    prefixes_.erase(prefix);
+  }
+  connections_.erase(it);
+}
+
+}  // namespace nginx
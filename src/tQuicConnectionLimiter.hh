@@ -0,0 +1,71 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack connection limits per client prefix.
+
+#ifndef _NGINX_T_QUIC_CONNECTION_LIMITER_H_
+#define _NGINX_T_QUIC_CONNECTION_LIMITER_H_
+
+#include <stdint.h>
+
+#include <unordered_map>
+
+#include "quic/core/quic_connection_id.h"
+#include "quic/platform/api/quic_socket_address.h"
+
+namespace nginx {
+
+// Counts connections per client prefix and in total, consulted before a new
+// connection is created so an overloaded worker or an abusive prefix is
+// refused before any handshake work is done.
+class tQuicConnectionLimiter {
+ public:
+  enum Verdict {
+    CONNECTION_ACCEPTED,
+    CONNECTION_OVER_TOTAL,
+    CONNECTION_OVER_PREFIX,
+  };
+
+  tQuicConnectionLimiter();
+  tQuicConnectionLimiter(const tQuicConnectionLimiter&) = delete;
+  tQuicConnectionLimiter& operator=(const tQuicConnectionLimiter&) = delete;
+
+  // Zero limits are unlimited, prefix lengths are clamped to the family.
+  void SetLimits(uint64_t max_connections,
+                 uint32_t max_per_prefix,
+                 uint8_t ipv4_prefix_len,
+                 uint8_t ipv6_prefix_len);
+
+  bool enabled() const { return max_connections_ > 0 || max_per_prefix_ > 0; }
+
+  // Whether one more connection from |peer| fits.
+  Verdict Check(const quic::QuicSocketAddress& peer) const;
+
+  // Packets of |connection_id| belong to a connection already counted.
+  bool IsKnown(const quic::QuicConnectionId& connection_id) const {
+    return connections_.find(connection_id) != connections_.end();
+  }
+
+  void OnConnectionCreated(const quic::QuicConnectionId& connection_id,
+                           const quic::QuicSocketAddress& peer);
+  void OnConnectionClosed(const quic::QuicConnectionId& connection_id);
+
+  size_t connections() const { return connections_.size(); }
+  size_t prefixes() const { return prefixes_.size(); }
+
+ private:
+  // Hash of the masked address, colliding prefixes share one counter which
+  // errs on the side of refusing.
+  uint64_t PrefixKey(const quic::QuicSocketAddress& peer) const;
+
+  uint64_t  max_connections_;
+  uint32_t  max_per_prefix_;
+  uint8_t   ipv4_prefix_len_;
+  uint8_t   ipv6_prefix_len_;
+
+  std::unordered_map<uint64_t, uint32_t> prefixes_;
+  std::unordered_map<quic::QuicConnectionId, uint64_t,
+                     quic::QuicConnectionIdHash> connections_;
+};
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_CONNECTION_LIMITER_H_
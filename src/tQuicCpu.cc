@@ -0,0 +1,98 @@
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/filter.h>
+
+#include "src/tQuicCpu.hh"
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+namespace nginx {
+
+int IncomingCpu(int fd) {
+  int cpu = -1;
+  socklen_t len = sizeof(cpu);
+  if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0) {
+    return -1;
+  }
+  return cpu;
+}
+
+int CpuNumaNode(int cpu) {
+  if (cpu < 0) {
+    return -1;
+  }
+
+  // The cpu directory holds a "nodeN" link on NUMA kernels.
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR* dir = opendir(path);
+  if (dir == nullptr) {
+    return -1;
+  }
+
+  int node = -1;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (strncmp(entry->d_name, "node", 4) == 0 &&
+        entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+      node = atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+bool BindThreadToCpu(int cpu, int numa_node) {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    return false;
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+    return false;
+  }
+
+  // Best effort, a failure only loses locality. libnuma is not required,
+  // set_mempolicy is called directly.
+  if (numa_node >= 0 && numa_node < static_cast<int>(sizeof(unsigned long) * 8)) {
+    unsigned long nodemask = 1UL << numa_node;
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask,
+            sizeof(nodemask) * 8);
+  }
+  return true;
+}
+
+bool AttachReuseportCpuFilter(int fd) {
+  // A = raw_smp_processor_id(); return A;
+  struct sock_filter code[] = {
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU) },
+    { BPF_RET | BPF_A, 0, 0, 0 },
+  };
+  struct sock_fprog prog;
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+
+  return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                    &prog, sizeof(prog)) == 0;
+}
+
+}  // namespace nginx
@@ -0,0 +1,27 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack CPU and NUMA placement helpers.
+
+#ifndef _NGINX_T_QUIC_CPU_H_
+#define _NGINX_T_QUIC_CPU_H_
+
+namespace nginx {
+
+// Returns the CPU that handled the last packet received on |fd|
+// (SO_INCOMING_CPU), -1 if unknown.
+int IncomingCpu(int fd);
+
+// Returns the NUMA node |cpu| belongs to, -1 if unknown or not NUMA.
+int CpuNumaNode(int cpu);
+
+// Pins the calling thread to |cpu| and makes its future allocations prefer
+// |numa_node| (ignored when negative). Returns false if pinning failed.
+bool BindThreadToCpu(int cpu, int numa_node);
+
+// Attaches a classic BPF program to the SO_REUSEPORT group of |fd| selecting
+// the socket whose index equals the CPU that received the packet. Sockets
+// past the group size fall back to the kernel hash.
+bool AttachReuseportCpuFilter(int fd);
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_CPU_H_
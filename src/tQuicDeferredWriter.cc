@@ -0,0 +1,300 @@
+#include <algorithm>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "src/tQuicDeferredWriter.hh"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+using namespace quic;
+
+namespace nginx {
+
+namespace {
+  // Room for the source address and the GSO segment size.
+  struct ControlBuffer {
+    alignas(cmsghdr) char data[CMSG_SPACE(sizeof(in6_pktinfo)) +
+                               CMSG_SPACE(sizeof(uint16_t))];
+  };
+
+  bool SameRoute(const QuicIpAddress& self_a, const QuicSocketAddress& peer_a,
+                 const QuicIpAddress& self_b, const QuicSocketAddress& peer_b) {
+    return peer_a == peer_b && self_a == self_b;
+  }
+
+  // Source address as IP_PKTINFO, as the base class writers set it.
+  size_t SetSelfAddress(const QuicIpAddress& self_address, cmsghdr* cmsg) {
+    if (self_address.IsIPv4()) {
+      cmsg->cmsg_level = IPPROTO_IP;
+      cmsg->cmsg_type  = IP_PKTINFO;
+      cmsg->cmsg_len   = CMSG_LEN(sizeof(in_pktinfo));
+      in_pktinfo pktinfo;
+      memset(&pktinfo, 0, sizeof(pktinfo));
+      pktinfo.ipi_spec_dst = self_address.GetIPv4();
+      memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+      return CMSG_SPACE(sizeof(in_pktinfo));
+    }
+
+    cmsg->cmsg_level = IPPROTO_IPV6;
+    cmsg->cmsg_type  = IPV6_PKTINFO;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(in6_pktinfo));
+    in6_pktinfo pktinfo;
+    memset(&pktinfo, 0, sizeof(pktinfo));
+    pktinfo.ipi6_addr = self_address.GetIPv6();
+    memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+    return CMSG_SPACE(sizeof(in6_pktinfo));
+  }
+}
+
+tQuicDeferredWriter::tQuicDeferredWriter(int fd, tQuicStackStats* stats)
+    : fd_(fd),
+      write_blocked_(false),
+      gso_disabled_(false),
+      stats_(stats) {
+  packets_.reserve(kMaxPackets);
+}
+
+tQuicDeferredWriter::~tQuicDeferredWriter() {}
+
+WriteResult tQuicDeferredWriter::WritePacket(
+    const char* buffer,
+    size_t buf_len,
+    const QuicIpAddress& self_address,
+    const QuicSocketAddress& peer_address,
+    PerPacketOptions* /*options*/) {
+  QUICHE_DCHECK(!write_blocked_);
+  QUICHE_DCHECK_LE(buf_len, kMaxOutgoingPacketSize);
+
+  if (packets_.size() == kMaxPackets) {
+    // Full before the end of the loop, send what we have now.
+    stats_->deferred_early_flushes++;
+    WriteResult result = FlushDeferred();
+    if (result.status != WRITE_STATUS_OK) {
+      // The packet was not buffered, the connection writes it again later.
+      return result;
+    }
+  }
+
+  // The packet may have been serialized in place by GetNextWriteLocation().
+  char* location = Slot(packets_.size());
+  if (buffer != location) {
+    memcpy(location, buffer, buf_len);
+  }
+  packets_.push_back(Packet{buf_len, self_address, peer_address});
+  return WriteResult(WRITE_STATUS_OK, 0);
+}
+
+bool tQuicDeferredWriter::IsWriteBlocked() const {
+  return write_blocked_;
+}
+
+void tQuicDeferredWriter::SetWritable() {
+  write_blocked_ = false;
+}
+
+QuicByteCount tQuicDeferredWriter::GetMaxPacketSize(
+    const QuicSocketAddress& /*peer_address*/) const {
+  return kMaxOutgoingPacketSize;
+}
+
+bool tQuicDeferredWriter::SupportsReleaseTime() const {
+  return false;
+}
+
+bool tQuicDeferredWriter::IsBatchMode() const {
+  return true;
+}
+
+char* tQuicDeferredWriter::GetNextWriteLocation(
+    const QuicIpAddress& /*self_address*/,
+    const QuicSocketAddress& /*peer_address*/) {
+  if (packets_.size() == kMaxPackets) {
+    return nullptr;
+  }
+  return Slot(packets_.size());
+}
+
+WriteResult tQuicDeferredWriter::Flush() {
+  // Held until FlushDeferred(), the connection counts the data as sent.
+  return WriteResult(WRITE_STATUS_OK, 0);
+}
+
+void tQuicDeferredWriter::BuildMessages(
+    std::vector<Message>* messages,
+    std::vector<size_t>* order) {
+  std::vector<bool> taken(packets_.size(), false);
+
+  for (size_t i = 0; i < packets_.size(); i++) {
+    if (taken[i]) {
+      continue;
+    }
+    const Packet& first = packets_[i];
+    Message message = {order->size(), 1, first.len, first.len};
+    order->push_back(i);
+    taken[i] = true;
+
+    // Later packets of the same route join while they fit. One that does
+    // not ends the message, so packets of a route keep their order.
+    for (size_t j = i + 1; !gso_disabled_ && j < packets_.size() &&
+         message.num_segments < kMaxGsoSegments; j++) {
+      const Packet& next = packets_[j];
+      if (taken[j] || !SameRoute(first.self_address, first.peer_address,
+                                 next.self_address, next.peer_address)) {
+        continue;
+      }
+      if (next.len > message.segment_size ||
+          message.bytes + next.len > kMaxGsoBytes) {
+        break;
+      }
+      order->push_back(j);
+      taken[j] = true;
+      message.num_segments++;
+      message.bytes += next.len;
+
+      // A short packet can only be the last GSO segment.
+      if (next.len < message.segment_size) {
+        break;
+      }
+    }
+    messages->push_back(message);
+  }
+}
+
+void tQuicDeferredWriter::KeepUnsent(const std::vector<size_t>& order,
+                                     size_t first_unsent) {
+  // Slots are compacted in send order, through a copy as sources and
+  // destinations may overlap.
+  size_t count = order.size() - first_unsent;
+  std::vector<char> data(count * kMaxOutgoingPacketSize);
+  std::vector<Packet> kept;
+  kept.reserve(count);
+  for (size_t k = 0; k < count; k++) {
+    size_t index = order[first_unsent + k];
+    memcpy(data.data() + k * kMaxOutgoingPacketSize, Slot(index),
+           packets_[index].len);
+    kept.push_back(packets_[index]);
+  }
+  for (size_t k = 0; k < count; k++) {
+    memcpy(Slot(k), data.data() + k * kMaxOutgoingPacketSize, kept[k].len);
+  }
+  packets_.swap(kept);
+}
+
+WriteResult tQuicDeferredWriter::FlushDeferred() {
+  if (packets_.empty()) {
+    return WriteResult(WRITE_STATUS_OK, 0);
+  }
+  if (write_blocked_) {
+    return WriteResult(WRITE_STATUS_BLOCKED, EAGAIN);
+  }
+
+  std::vector<Message> messages;
+  std::vector<size_t> order;
+  order.reserve(packets_.size());
+  BuildMessages(&messages, &order);
+
+  std::vector<iovec> iov(order.size());
+  for (size_t k = 0; k < order.size(); k++) {
+    iov[k].iov_base = Slot(order[k]);
+    iov[k].iov_len  = packets_[order[k]].len;
+  }
+
+  std::vector<mmsghdr> hdrs(messages.size());
+  std::vector<sockaddr_storage> peers(messages.size());
+  std::vector<ControlBuffer> controls(messages.size());
+  for (size_t m = 0; m < messages.size(); m++) {
+    const Message& message = messages[m];
+    const Packet& packet = packets_[order[message.first_iov]];
+
+    peers[m] = packet.peer_address.generic_address();
+    memset(&hdrs[m], 0, sizeof(hdrs[m]));
+    msghdr* msg = &hdrs[m].msg_hdr;
+    msg->msg_name    = &peers[m];
+    msg->msg_namelen = peers[m].ss_family == AF_INET6 ? sizeof(sockaddr_in6)
+                                                      : sizeof(sockaddr_in);
+    msg->msg_iov     = &iov[message.first_iov];
+    msg->msg_iovlen  = message.num_segments;
+
+    bool has_self = packet.self_address.IsInitialized() &&
+                    !packet.self_address.IsAny();
+    if (!has_self && message.num_segments == 1) {
+      continue;
+    }
+
+    memset(controls[m].data, 0, sizeof(controls[m].data));
+    msg->msg_control    = controls[m].data;
+    msg->msg_controllen = sizeof(controls[m].data);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(msg);
+    size_t control_len = 0;
+    if (has_self) {
+      control_len += SetSelfAddress(packet.self_address, cmsg);
+      cmsg = CMSG_NXTHDR(msg, cmsg);
+    }
+    if (message.num_segments > 1) {
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type  = UDP_SEGMENT;
+      cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+      uint16_t gso_size = static_cast<uint16_t>(message.segment_size);
+      memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+      control_len += CMSG_SPACE(sizeof(uint16_t));
+    }
+    msg->msg_controllen = control_len;
+  }
+
+  stats_->deferred_flushes++;
+  size_t bytes_written = 0;
+  size_t next = 0;
+  while (next < messages.size()) {
+    int rc;
+    do {
+      rc = sendmmsg(fd_, &hdrs[next], messages.size() - next, 0);
+    } while (rc < 0 && errno == EINTR);
+    stats_->deferred_syscalls++;
+
+    if (rc < 0) {
+      int error = errno;
+      if (error == EAGAIN || error == EWOULDBLOCK) {
+        write_blocked_ = true;
+        KeepUnsent(order, messages[next].first_iov);
+        return WriteResult(WRITE_STATUS_BLOCKED, error);
+      }
+      if (!gso_disabled_ && messages[next].num_segments > 1 &&
+          (error == EIO || error == EINVAL || error == ENOPROTOOPT)) {
+        // Kernel or device without UDP GSO, stay on plain sends from now on.
+        gso_disabled_ = true;
+        KeepUnsent(order, messages[next].first_iov);
+        WriteResult result = FlushDeferred();
+        if (result.status == WRITE_STATUS_OK) {
+          result.bytes_written += bytes_written;
+        }
+        return result;
+      }
+
+      // The first message failed for good, drop it and go on.
+      stats_->deferred_send_errors++;
+      next++;
+      continue;
+    }
+
+    for (int m = 0; m < rc; m++) {
+      stats_->deferred_packets += messages[next + m].num_segments;
+      bytes_written += messages[next + m].bytes;
+    }
+    next += rc;
+  }
+
+  packets_.clear();
+  return WriteResult(WRITE_STATUS_OK, bytes_written);
+}
+
+}  // namespace nginx
@@ -0,0 +1,93 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack writer deferring egress to one flush per loop.
+
+#ifndef _NGINX_T_QUIC_DEFERRED_WRITER_H_
+#define _NGINX_T_QUIC_DEFERRED_WRITER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "quic/core/quic_constants.h"
+#include "quic/core/quic_packet_writer.h"
+#include "quic/platform/api/quic_socket_address.h"
+#include "src/quic_stack_api.h"
+
+namespace nginx {
+
+// Writer of a shared, unconnected UDP socket which holds the packets of all
+// connections until FlushDeferred(), called once per event loop iteration.
+// Flush() from the connections is a no-op, so a loop serving many
+// connections with a few packets each ends in a handful of sendmmsg calls.
+// Packets to the same destination are sent as one UDP GSO message.
+class tQuicDeferredWriter : public quic::QuicPacketWriter {
+ public:
+  tQuicDeferredWriter(int fd, tQuicStackStats* stats);
+  tQuicDeferredWriter(const tQuicDeferredWriter&) = delete;
+  tQuicDeferredWriter& operator=(const tQuicDeferredWriter&) = delete;
+  ~tQuicDeferredWriter() override;
+
+  // QuicPacketWriter
+  quic::WriteResult WritePacket(const char* buffer,
+                          size_t buf_len,
+                          const quic::QuicIpAddress& self_address,
+                          const quic::QuicSocketAddress& peer_address,
+                          quic::PerPacketOptions* options) override;
+  bool IsWriteBlocked() const override;
+  void SetWritable() override;
+  quic::QuicByteCount GetMaxPacketSize(
+      const quic::QuicSocketAddress& peer_address) const override;
+  bool SupportsReleaseTime() const override;
+  bool IsBatchMode() const override;
+  char* GetNextWriteLocation(const quic::QuicIpAddress& self_address,
+                             const quic::QuicSocketAddress& peer_address) override;
+  quic::WriteResult Flush() override;
+
+  // Sends everything held, packets the socket refused stay for the next
+  // call and leave the writer blocked.
+  quic::WriteResult FlushDeferred();
+
+  bool HasPending() const { return !packets_.empty(); }
+
+ private:
+  // Packets held between flushes and kernel limits of one UDP GSO send.
+  static const size_t kMaxPackets = 256;
+  static const size_t kMaxGsoSegments = 64;
+  static const size_t kMaxGsoBytes = 64 * 1024 - 1;
+
+  struct Packet {
+    size_t                   len;
+    quic::QuicIpAddress      self_address;
+    quic::QuicSocketAddress  peer_address;
+  };
+
+  // One sendmmsg message, |num_segments| packets from |first_iov| on in
+  // send order.
+  struct Message {
+    size_t first_iov;
+    size_t num_segments;
+    size_t segment_size;
+    size_t bytes;
+  };
+
+  char* Slot(size_t index) { return buffer_[index]; }
+
+  // Groups the pending packets into GSO messages by destination, |order|
+  // gets their indices in send order.
+  void BuildMessages(std::vector<Message>* messages,
+                     std::vector<size_t>* order);
+
+  // Keeps the packets from |order[first_unsent]| on for the next flush.
+  void KeepUnsent(const std::vector<size_t>& order, size_t first_unsent);
+
+  int fd_;
+  bool write_blocked_;
+  bool gso_disabled_;
+  tQuicStackStats* stats_;
+
+  std::vector<Packet> packets_;
+  char buffer_[kMaxPackets][quic::kMaxOutgoingPacketSize];
+};
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_DEFERRED_WRITER_H_
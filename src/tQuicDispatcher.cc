@@ -1,3 +1,8 @@
+#include <algorithm>
+
+#include "quic/core/crypto/quic_random.h"
+#include "quic/core/quic_framer.h"
+#include "src/tQuicConnectedWriter.hh"
 #include "src/tQuicDispatcher.hh"
 #include "src/tQuicServerSession.hh"
 
@@ -15,7 +20,8 @@ tQuicDispatcher::tQuicDispatcher(
     uint8_t expected_server_connection_id_length,
     tQuicStackContext stack_ctx,
     tQuicRequestCallback cb,
-    tQuicServerIdentifyManager* qsi_ptr)
+    tQuicServerIdentifyManager* qsi_ptr,
+    tQuicStackStats* stats)
     : QuicDispatcher(config,
                      crypto_config,
                      version_manager,
@@ -25,25 +31,408 @@ tQuicDispatcher::tQuicDispatcher(
                      expected_server_connection_id_length),
       stack_ctx_(stack_ctx),
       callback_(cb),
-      qsi_mgr_(qsi_ptr) {
+      qsi_mgr_(qsi_ptr),
+      stats_(stats),
+      write_blocked_(false),
+      write_blocked_since_(QuicTime::Zero()),
+      max_connection_age_(QuicTime::Delta::Zero()),
+      max_connection_age_grace_(QuicTime::Delta::Zero()),
+      draining_(false),
+      drain_deadline_(QuicTime::Zero()),
+      connected_udp_threshold_(QuicBandwidth::Zero()),
+      transport_info_headers_(false),
+      deferred_flush_(false),
+      header_names_(&tQuicHeaderNameTable::Default()),
+      header_timeout_(QuicTime::Delta::Zero()),
+      progress_window_(QuicTime::Delta::Zero()),
+      min_progress_bytes_(1),
+      stream_limit_tuning_(false),
+      stream_limit_base_(0),
+      stream_limit_max_(0),
+      max_open_streams_(0),
+      stream_limit_target_(0),
+      streams_blocked_seen_(false),
+      logger_(nullptr) {
   write_blocked_cb_.OnCanWriteCallback = nullptr;
   write_blocked_cb_.OnCanWriteContext  = nullptr;
+  writable_cb_.OnCanWriteCallback = nullptr;
+  writable_cb_.OnCanWriteContext  = nullptr;
+  socket_cb_.OnSocketOpen  = nullptr;
+  socket_cb_.OnSocketClose = nullptr;
+  socket_cb_.SocketContext = nullptr;
+  socket_cb_.OnSocketBlocked = nullptr;
+  conn_cb_.OnConnectionOpen    = nullptr;
+  conn_cb_.OnHandshakeComplete = nullptr;
+  conn_cb_.OnConnectionClose   = nullptr;
+  conn_cb_.ConnectionContext   = nullptr;
 }
 
-tQuicDispatcher::~tQuicDispatcher() {}
+tQuicDispatcher::~tQuicDispatcher() {
+  // Sessions are destroyed by the base class after our writers and
+  // callbacks, connected sockets go back to the shared ones while both
+  // are still there.
+  for (const auto& session : GetSessionsSnapshot()) {
+    static_cast<tQuicServerSession*>(session.get())->DemoteFromConnectedUdp();
+  }
+}
 
 void tQuicDispatcher::SetWriteBlockedCallback(tQuicOnCanWriteCallback write_blocked_cb) {
   write_blocked_cb_ = write_blocked_cb;
 }
 
+void tQuicDispatcher::SetWritableCallback(tQuicOnCanWriteCallback writable_cb) {
+  writable_cb_ = writable_cb;
+}
+
 void tQuicDispatcher::OnWriteBlocked(quic::QuicBlockedWriterInterface* blocked_writer) {
-  quic::QuicDispatcher::OnWriteBlocked(blocked_writer);
+  // Connections wait in their tenant queue, the rest in the base list.
+  if (!tenants_.OnWriteBlocked(blocked_writer)) {
+    quic::QuicDispatcher::OnWriteBlocked(blocked_writer);
+  }
+
+  // A connected socket is the host's to watch, the shared ones are fine.
+  auto it = connected_writers_.find(blocked_writer);
+  if (it != connected_writers_.end()) {
+    if (socket_cb_.OnSocketBlocked) {
+      socket_cb_.OnSocketBlocked(it->second->fd(), socket_cb_.SocketContext);
+    }
+    return;
+  }
+  ReportWriteBlocked();
+}
+
+void tQuicDispatcher::ReportWriteBlocked() {
+  // Every connection hitting the blocked socket lands here, only the first
+  // one after the writer turned blocked is reported to the host.
+  if (write_blocked_) {
+    return;
+  }
+  write_blocked_ = true;
+  write_blocked_since_ = helper()->GetClock()->ApproximateNow();
+  stats_->write_blocked_events++;
+  stats_->write_blocked = 1;
 
   if (write_blocked_cb_.OnCanWriteCallback) {
       write_blocked_cb_.OnCanWriteCallback(write_blocked_cb_.OnCanWriteContext);
   }
 }
 
+void tQuicDispatcher::OnCanWrite() {
+  // The base class only knows its own writer, the host does not tell which
+  // socket turned writable so every writer is given another try.
+  for (auto& w : writers_) {
+    w.second->SetWritable();
+  }
+  quic::QuicDispatcher::OnCanWrite();
+  tenants_.OnCanWrite([this]() { return WritersBlocked(); });
+
+  // Blocked connections may have filled the socket again while draining,
+  // in that case the writer stays blocked and nothing is reported.
+  if (!write_blocked_ || WritersBlocked()) {
+    return;
+  }
+  write_blocked_ = false;
+  stats_->write_blocked = 0;
+
+  uint64_t blocked_us =
+    (helper()->GetClock()->ApproximateNow() - write_blocked_since_).ToMicroseconds();
+  stats_->write_blocked_total_us += blocked_us;
+  if (blocked_us > stats_->write_blocked_max_us) {
+    stats_->write_blocked_max_us = blocked_us;
+  }
+
+  if (writable_cb_.OnCanWriteCallback) {
+      writable_cb_.OnCanWriteCallback(writable_cb_.OnCanWriteContext);
+  }
+}
+
+bool tQuicDispatcher::HasPendingWrites() const {
+  return quic::QuicDispatcher::HasPendingWrites() || tenants_.HasPendingWrites();
+}
+
+bool tQuicDispatcher::WritersBlocked() {
+  if (writer()->IsWriteBlocked()) {
+    return true;
+  }
+  for (auto& w : writers_) {
+    if (w.second->IsWriteBlocked()) {
+      return true;
+    }
+  }
+  for (auto& w : connected_writers_) {
+    if (w.second->IsWriteBlocked()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void tQuicDispatcher::ProcessPacket(
+    const QuicSocketAddress& self_address,
+    const QuicSocketAddress& peer_address,
+    const QuicReceivedPacket& packet) {
+  current_self_address_ = self_address;
+  if (limiter_.enabled() && MaybeRefuseConnection(peer_address, packet)) {
+    return;
+  }
+  QuicDispatcher::ProcessPacket(self_address, peer_address, packet);
+}
+
+bool tQuicDispatcher::MaybeRefuseConnection(
+    const QuicSocketAddress& peer_address,
+    const QuicReceivedPacket& packet) {
+  PacketHeaderFormat format = GOOGLE_QUIC_PACKET;
+  QuicLongHeaderType long_packet_type = INVALID_PACKET_TYPE;
+  bool version_flag = false;
+  bool use_length_prefix = false;
+  QuicVersionLabel version_label = 0;
+  ParsedQuicVersion version = UnsupportedQuicVersion();
+  QuicConnectionId destination_connection_id, source_connection_id;
+  bool retry_token_present = false;
+  absl::string_view retry_token;
+  std::string detailed_error;
+  QuicErrorCode error = QuicFramer::ParsePublicHeaderDispatcher(
+      packet, expected_server_connection_id_length(), &format,
+      &long_packet_type, &version_flag, &use_length_prefix, &version_label,
+      &version, &destination_connection_id, &source_connection_id,
+      &retry_token_present, &retry_token, &detailed_error);
+
+  // Only the first flight of a connection not created yet is checked, the
+  // base class deals with everything else including version negotiation.
+  if (error != QUIC_NO_ERROR || !version_flag || !version.IsKnown() ||
+      (format == IETF_QUIC_LONG_HEADER_PACKET && long_packet_type != INITIAL) ||
+      time_wait_list_manager()->IsConnectionIdInTimeWait(destination_connection_id)) {
+    return false;
+  }
+
+  // The lookup of live connections is only paid for packets to be refused.
+  tQuicConnectionLimiter::Verdict verdict = limiter_.Check(peer_address);
+  if (verdict == tQuicConnectionLimiter::CONNECTION_ACCEPTED ||
+      IsKnownConnectionId(destination_connection_id)) {
+    return false;
+  }
+
+  const char* reason;
+  if (verdict == tQuicConnectionLimiter::CONNECTION_OVER_TOTAL) {
+    stats_->connections_refused_overload++;
+    reason = "Server overloaded";
+  } else {
+    stats_->connections_refused_prefix++;
+    reason = "Too many connections from client prefix";
+  }
+  TQUIC_LOG(logger_, QUIC_LOG_MODULE_DISPATCHER, QUIC_LOG_INFO,
+            "connection from %s refused: %s",
+            peer_address.ToString().c_str(), reason);
+
+  // Same answer the base class gives once it stops accepting connections,
+  // the time wait list repeats it for the rest of the client's flight.
+  StatelesslyTerminateConnection(
+      destination_connection_id, format, version_flag, use_length_prefix,
+      version, QUIC_HANDSHAKE_FAILED, reason,
+      QuicTimeWaitListManager::SEND_TERMINATION_PACKETS);
+  return true;
+}
+
+bool tQuicDispatcher::IsKnownConnectionId(const QuicConnectionId& connection_id) {
+  if (limiter_.IsKnown(connection_id) || HasBufferedPackets(connection_id)) {
+    return true;
+  }
+
+  // Client Initials keep the original id until they see ours, the limiter
+  // only knows the one the connection was created with.
+  for (const auto& session : GetSessionsSnapshot()) {
+    if (session->connection()->GetOriginalDestinationConnectionId() == connection_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void tQuicDispatcher::OnConnectionClosed(
+    QuicConnectionId server_connection_id,
+    QuicErrorCode error,
+    const std::string& error_details,
+    ConnectionCloseSource source) {
+  limiter_.OnConnectionClosed(server_connection_id);
+  stats_->connection_prefixes = limiter_.prefixes();
+  QuicDispatcher::OnConnectionClosed(server_connection_id, error,
+                                     error_details, source);
+}
+
+void tQuicDispatcher::SetConnectionLimits(
+    uint64_t max_connections,
+    uint32_t max_per_prefix,
+    uint8_t ipv4_prefix_len,
+    uint8_t ipv6_prefix_len) {
+  limiter_.SetLimits(max_connections, max_per_prefix,
+                     ipv4_prefix_len, ipv6_prefix_len);
+}
+
+void tQuicDispatcher::SetPreferredAddress(const QuicSocketAddress& address) {
+  if (address.host().IsIPv4()) {
+    preferred_address_v4_ = address;
+  } else if (address.host().IsIPv6()) {
+    preferred_address_v6_ = address;
+  }
+}
+
+void tQuicDispatcher::ClearPreferredAddress() {
+  preferred_address_v4_ = QuicSocketAddress();
+  preferred_address_v6_ = QuicSocketAddress();
+}
+
+bool tQuicDispatcher::AllowSelfAddressChange(QuicConnection* connection) {
+  if (current_self_address_.IsInitialized() &&
+      (current_self_address_ == preferred_address_v4_ ||
+       current_self_address_ == preferred_address_v6_)) {
+    stats_->preferred_address_migrations++;
+    connection->SetQuicPacketWriter(GetWriter(current_self_address_),
+                                    /* owns_writer= */ false);
+    return true;
+  }
+
+  stats_->self_address_changes_rejected++;
+  return false;
+}
+
+void tQuicDispatcher::SetMaxConnectionAge(
+    QuicTime::Delta max_age,
+    QuicTime::Delta grace) {
+  max_connection_age_ = max_age;
+  max_connection_age_grace_ = grace;
+}
+
+void tQuicDispatcher::Drain(QuicTime deadline) {
+  if (!draining_ || deadline < drain_deadline_) {
+    drain_deadline_ = deadline;
+  }
+  draining_ = true;
+
+  for (const auto& session : GetSessionsSnapshot()) {
+    static_cast<tQuicServerSession*>(session.get())->StartDraining(drain_deadline_);
+  }
+}
+
+size_t tQuicDispatcher::UpdateIdleTimeout(QuicTime::Delta idle_timeout) {
+  size_t updated = 0;
+  for (const auto& session : GetSessionsSnapshot()) {
+    if (static_cast<tQuicServerSession*>(session.get())->UpdateIdleTimeout(idle_timeout)) {
+      updated++;
+    }
+  }
+  return updated;
+}
+
+void tQuicDispatcher::AddWriter(
+    const QuicSocketAddress& self_address,
+    std::unique_ptr<QuicPacketWriter> writer) {
+  writers_.emplace_back(self_address.Normalized(), std::move(writer));
+}
+
+QuicPacketWriter* tQuicDispatcher::GetWriter(const QuicSocketAddress& self_address) {
+  if (writers_.empty()) {
+    return writer();
+  }
+
+  QuicSocketAddress address = self_address.Normalized();
+  QuicPacketWriter* wildcard = nullptr;
+  for (auto& w : writers_) {
+    if (w.first == address) {
+      return w.second.get();
+    }
+    if (wildcard == nullptr && w.first.port() == address.port() &&
+        w.first.host().address_family() == address.host().address_family() &&
+        (w.first.host() == QuicIpAddress::Any4() ||
+         w.first.host() == QuicIpAddress::Any6())) {
+      wildcard = w.second.get();
+    }
+  }
+
+  return wildcard ? wildcard : writer();
+}
+
+void tQuicDispatcher::SetConnectedUdpThreshold(QuicBandwidth threshold) {
+  connected_udp_threshold_ = threshold;
+}
+
+void tQuicDispatcher::SetStreamProgressLimits(
+    QuicTime::Delta header_timeout,
+    QuicTime::Delta progress_window,
+    QuicByteCount min_progress_bytes) {
+  header_timeout_ = header_timeout;
+  progress_window_ = progress_window;
+  min_progress_bytes_ = min_progress_bytes;
+}
+
+void tQuicDispatcher::SetStreamLimitTuning(
+    bool enabled,
+    uint32_t base,
+    uint32_t max_limit,
+    uint64_t max_open_streams) {
+  stream_limit_tuning_ = enabled;
+  stream_limit_base_ = base;
+  stream_limit_max_ = std::max(base, max_limit);
+  max_open_streams_ = max_open_streams;
+  if (!enabled || stream_limit_target_ == 0) {
+    stream_limit_target_ = base;
+  }
+  stream_limit_target_ = std::min(stream_limit_target_, stream_limit_max_);
+  stats_->max_streams_target = stream_limit_target_;
+}
+
+void tQuicDispatcher::OnRequestStreamsClosed(uint64_t count) {
+  stats_->open_streams -= std::min(count, stats_->open_streams);
+}
+
+void tQuicDispatcher::OnRequestStreamsBlocked() {
+  stats_->streams_blocked_received++;
+  if (!stream_limit_tuning_) {
+    return;
+  }
+
+  // Grow by a quarter, the connections created from now on benefit.
+  streams_blocked_seen_ = true;
+  stream_limit_target_ = std::min<uint32_t>(
+    stream_limit_max_, stream_limit_target_ + stream_limit_target_ / 4 + 1);
+  stats_->max_streams_target = stream_limit_target_;
+}
+
+uint32_t tQuicDispatcher::NextStreamLimit() {
+  uint32_t floor = std::max<uint32_t>(stream_limit_base_ / 4, 1);
+  if (max_open_streams_ > 0 && stats_->open_streams >= max_open_streams_) {
+    // Memory pressure, halve down to a quarter of the base.
+    stream_limit_target_ = std::max(floor, stream_limit_target_ / 2);
+  } else if (!streams_blocked_seen_ && stream_limit_target_ != stream_limit_base_) {
+    // Nobody ran short since the last connection, drift back to the base.
+    if (stream_limit_target_ > stream_limit_base_) {
+      stream_limit_target_ -= (stream_limit_target_ - stream_limit_base_ + 15) / 16;
+    } else {
+      stream_limit_target_ += (stream_limit_base_ - stream_limit_target_ + 15) / 16;
+    }
+  }
+  streams_blocked_seen_ = false;
+  stats_->max_streams_target = stream_limit_target_;
+  return stream_limit_target_;
+}
+
+void tQuicDispatcher::SetSocketCallback(tQuicSocketCallback socket_cb) {
+  socket_cb_ = socket_cb;
+}
+
+void tQuicDispatcher::AddConnectedWriter(
+    QuicBlockedWriterInterface* connection,
+    tQuicConnectedWriter* writer) {
+  connected_writers_[connection] = writer;
+}
+
+void tQuicDispatcher::RemoveConnectedWriter(QuicBlockedWriterInterface* connection) {
+  connected_writers_.erase(connection);
+}
+
+void tQuicDispatcher::SetConnectionCallback(tQuicConnectionCallback conn_cb) {
+  conn_cb_ = conn_cb;
+}
+
 int tQuicDispatcher::GetRstErrorCount(
     QuicRstStreamErrorCode error_code) const {
   auto it = rst_error_map_.find(error_code);
@@ -72,14 +461,56 @@ std::unique_ptr<quic::QuicSession> tQuicDispatcher::CreateQuicSession(
     const ParsedClientHello& /*parsed_chlo*/) {
   // The QuicServerSessionBase takes ownership of |connection| below.
   QuicConnection* connection = new QuicConnection(
-      connection_id, self_address, peer_address, helper(), alarm_factory(), writer(),
+      connection_id, self_address, peer_address, helper(), alarm_factory(),
+      GetWriter(self_address),
       /* owns_writer= */ false, Perspective::IS_SERVER,
       ParsedQuicVersionVector{version});
 
+  // The session sizes its stream id managers from the config it is given,
+  // a tuned limit has to be in place before it is created.
+  QuicConfig tuned_config;
+  const QuicConfig* session_config = &config();
+  if (stream_limit_tuning_) {
+    tuned_config = config();
+    tuned_config.SetMaxBidirectionalStreamsToSend(NextStreamLimit());
+    session_config = &tuned_config;
+  }
+
   std::unique_ptr<tQuicServerSession> session = std::make_unique<tQuicServerSession> (
-      config(), GetSupportedVersions(), connection, this, session_helper(),
+      *session_config, GetSupportedVersions(), connection, this, session_helper(),
       crypto_config(), compressed_certs_cache(), stack_ctx_, callback_, qsi_mgr_);
+
+  // preferred_address is an IETF transport parameter, it is sent along with
+  // the TLS handshake only.
+  if (version.UsesTls() &&
+      (preferred_address_v4_.IsInitialized() || preferred_address_v6_.IsInitialized())) {
+    if (preferred_address_v4_.IsInitialized()) {
+      session->config()->SetIPv4AlternateServerAddressToSend(preferred_address_v4_);
+    }
+    if (preferred_address_v6_.IsInitialized()) {
+      session->config()->SetIPv6AlternateServerAddressToSend(preferred_address_v6_);
+    }
+    stats_->preferred_address_advertised++;
+  }
+
   session->Initialize();
+  tenants_.Attach(session.get());
+  limiter_.OnConnectionCreated(connection->connection_id(), peer_address);
+  stats_->connection_prefixes = limiter_.prefixes();
+  session->OnConnectionOpen();
+
+  if (draining_) {
+    session->StartDraining(drain_deadline_);
+  } else if (!max_connection_age_.IsZero()) {
+    // Spread expirations over +/-10% so connections accepted in a burst
+    // do not all go away at once.
+    int64_t age_us = max_connection_age_.ToMicroseconds();
+    int64_t jitter_us = age_us / 5 == 0 ? 0 :
+      static_cast<int64_t>(helper()->GetRandomGenerator()->RandUint64() % (age_us / 5)) - age_us / 10;
+    session->SetMaxAge(
+      helper()->GetClock()->ApproximateNow() + QuicTime::Delta::FromMicroseconds(age_us + jitter_us),
+      max_connection_age_grace_);
+  }
   return session;
 }
 
@@ -4,15 +4,25 @@
 #ifndef _NGINX_T_QUIC_DISPATCH_H_
 #define _NGINX_T_QUIC_DISPATCH_H_
 
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "quic/core/http/quic_server_session_base.h"
 #include "quic/core/quic_crypto_server_stream.h"
 #include "quic/core/quic_dispatcher.h"
 #include "quic/core/quic_types.h"
 #include "src/quic_stack_api.h"
+#include "src/tQuicConnectionLimiter.hh"
+#include "src/tQuicHeaderUtil.hh"
+#include "src/tQuicLog.hh"
 #include "src/tQuicServerStream.hh"
+#include "src/tQuicTenant.hh"
 
 namespace nginx {
 
+class tQuicConnectedWriter;
+
 class tQuicDispatcher : public quic::QuicDispatcher {
  public:
   tQuicDispatcher(
@@ -25,7 +35,8 @@ class tQuicDispatcher : public quic::QuicDispatcher {
       uint8_t expected_server_connection_id_length,
       tQuicStackContext stack_ctx,
       tQuicRequestCallback cb,
-      tQuicServerIdentifyManager* qsi_ptr);
+      tQuicServerIdentifyManager* qsi_ptr,
+      tQuicStackStats* stats);
   ~tQuicDispatcher() override;
 
   int GetRstErrorCount(quic::QuicRstStreamErrorCode rst_error_code) const;
@@ -34,8 +45,123 @@ class tQuicDispatcher : public quic::QuicDispatcher {
 
   void SetWriteBlockedCallback(tQuicOnCanWriteCallback write_blocked_cb);
 
+  void SetWritableCallback(tQuicOnCanWriteCallback writable_cb);
+
   void OnWriteBlocked(quic::QuicBlockedWriterInterface* blocked_writer) override;
 
+  void OnCanWrite() override;
+
+  // A deferred flush left packets behind on a blocked socket.
+  void OnFlushBlocked() { ReportWriteBlocked(); }
+
+  // Shared writers are tQuicDeferredWriter, see quic_stack_flush.
+  void set_deferred_flush(bool deferred) { deferred_flush_ = deferred; }
+  bool deferred_flush() const { return deferred_flush_; }
+
+  bool HasPendingWrites() const override;
+
+  void ProcessPacket(const quic::QuicSocketAddress& self_address,
+                     const quic::QuicSocketAddress& peer_address,
+                     const quic::QuicReceivedPacket& packet) override;
+
+  void OnConnectionClosed(quic::QuicConnectionId server_connection_id,
+                          quic::QuicErrorCode error,
+                          const std::string& error_details,
+                          quic::ConnectionCloseSource source) override;
+
+  // New connections beyond these limits are refused statelessly.
+  void SetConnectionLimits(uint64_t max_connections,
+                           uint32_t max_per_prefix,
+                           uint8_t ipv4_prefix_len,
+                           uint8_t ipv6_prefix_len);
+
+  // Preferred address advertised to new connections, an uninitialized
+  // address clears the advertisement.
+  void SetPreferredAddress(const quic::QuicSocketAddress& address);
+  void ClearPreferredAddress();
+
+  // Whether a session may follow its peer to the self address of the packet
+  // being processed, only the advertised preferred addresses are accepted.
+  // |connection| is moved to the writer of the new address.
+  bool AllowSelfAddressChange(quic::QuicConnection* connection);
+
+  // Adds a writer for a socket bound to |self_address|, the dispatcher's own
+  // writer serves local addresses without a dedicated one.
+  void AddWriter(const quic::QuicSocketAddress& self_address,
+                 std::unique_ptr<quic::QuicPacketWriter> writer);
+
+  // Writer a connection on |self_address| should send with.
+  quic::QuicPacketWriter* GetWriter(const quic::QuicSocketAddress& self_address);
+
+  tQuicStackStats* stats() { return stats_; }
+
+  quic::QuicAlarmFactory* GetAlarmFactory() { return alarm_factory(); }
+
+  // Zero |max_age| leaves connection age unlimited.
+  void SetMaxConnectionAge(quic::QuicTime::Delta max_age,
+                           quic::QuicTime::Delta grace);
+
+  // Drains every session by |deadline|, see tQuicServerSession::StartDraining.
+  void Drain(quic::QuicTime deadline);
+
+  // Lowers the idle timeout of established sessions, returns how many.
+  size_t UpdateIdleTimeout(quic::QuicTime::Delta idle_timeout);
+
+  // Connected UDP fast path, enabled once both are set.
+  void SetConnectedUdpThreshold(quic::QuicBandwidth threshold);
+  void SetSocketCallback(tQuicSocketCallback socket_cb);
+
+  bool connected_udp_enabled() const {
+    return !connected_udp_threshold_.IsZero() && socket_cb_.OnSocketOpen != nullptr;
+  }
+  quic::QuicBandwidth connected_udp_threshold() const { return connected_udp_threshold_; }
+  const tQuicSocketCallback& socket_callback() const { return socket_cb_; }
+
+  // Connected socket |connection| sends through, its blocked edges are
+  // reported per socket instead of as the shared writer's.
+  void AddConnectedWriter(quic::QuicBlockedWriterInterface* connection,
+                          tQuicConnectedWriter* writer);
+  void RemoveConnectedWriter(quic::QuicBlockedWriterInterface* connection);
+
+  void set_logger(tQuicLogger* logger) { logger_ = logger; }
+  tQuicLogger* logger() { return logger_; }
+
+  void SetConnectionCallback(tQuicConnectionCallback conn_cb);
+  const tQuicConnectionCallback& connection_callback() const { return conn_cb_; }
+
+  // Whether requests carry the x-quic-* transport estimate headers.
+  void set_transport_info_headers(bool enabled) { transport_info_headers_ = enabled; }
+  bool transport_info_headers() const { return transport_info_headers_; }
+
+  // Interned header names of the stack, not owned.
+  void set_header_names(const tQuicHeaderNameTable* names) { header_names_ = names; }
+  const tQuicHeaderNameTable* header_names() const { return header_names_; }
+
+  // Limits after which stalled streams are reset, zero deltas disable them.
+  void SetStreamProgressLimits(quic::QuicTime::Delta header_timeout,
+                               quic::QuicTime::Delta progress_window,
+                               quic::QuicByteCount min_progress_bytes);
+  quic::QuicTime::Delta header_timeout() const { return header_timeout_; }
+  quic::QuicTime::Delta progress_window() const { return progress_window_; }
+  quic::QuicByteCount min_progress_bytes() const { return min_progress_bytes_; }
+  bool progress_check_enabled() const {
+    return !header_timeout_.IsZero() || !progress_window_.IsZero();
+  }
+
+  // Request limit auto tuning: new connections start at a target that
+  // grows on STREAMS_BLOCKED, shrinks while more than |max_open_streams|
+  // requests are open and otherwise returns to |base|.
+  void SetStreamLimitTuning(bool enabled,
+                            uint32_t base,
+                            uint32_t max_limit,
+                            uint64_t max_open_streams);
+  void OnRequestStreamOpened() { stats_->open_streams++; }
+  void OnRequestStreamsClosed(uint64_t count);
+  void OnRequestStreamsBlocked();
+
+  // Egress fairness across server contexts.
+  tQuicTenantScheduler* tenants() { return &tenants_; }
+
  protected:
   std::unique_ptr<quic::QuicSession> CreateQuicSession(
       quic::QuicConnectionId server_connection_id,
@@ -46,12 +172,79 @@ class tQuicDispatcher : public quic::QuicDispatcher {
       const quic::ParsedClientHello& parsed_chlo) override;
 
  private:
+  // Tells the host once when the writer turns blocked.
+  void ReportWriteBlocked();
+
+  // Refuses the first packet of a connection over the limits, true if the
+  // packet was consumed.
+  bool MaybeRefuseConnection(const quic::QuicSocketAddress& peer_address,
+                             const quic::QuicReceivedPacket& packet);
+
+  // Whether |connection_id| is one of a live connection, ours or the one
+  // the client started with, or has packets buffered.
+  bool IsKnownConnectionId(const quic::QuicConnectionId& connection_id);
+
+  // Request limit of the next connection, see SetStreamLimitTuning().
+  uint32_t NextStreamLimit();
+
+  // Whether the default writer, any per address one or any connected one
+  // is blocked.
+  bool WritersBlocked();
+
   // The map of the reset error code with its counter.
   std::map<quic::QuicRstStreamErrorCode, int> rst_error_map_;
   tQuicStackContext    stack_ctx_;
   tQuicRequestCallback callback_;
   tQuicServerIdentifyManager* qsi_mgr_;
   tQuicOnCanWriteCallback  write_blocked_cb_;
+  tQuicOnCanWriteCallback  writable_cb_;
+  tQuicStackStats*         stats_;
+
+  // Edge state of the writer, callbacks only fire when it flips.
+  bool                     write_blocked_;
+  quic::QuicTime           write_blocked_since_;
+
+  quic::QuicSocketAddress  preferred_address_v4_;
+  quic::QuicSocketAddress  preferred_address_v6_;
+  quic::QuicSocketAddress  current_self_address_;
+
+  // Per local address writers, a handful at most so a vector will do.
+  std::vector<std::pair<quic::QuicSocketAddress,
+                        std::unique_ptr<quic::QuicPacketWriter>>> writers_;
+
+  quic::QuicTime::Delta    max_connection_age_;
+  quic::QuicTime::Delta    max_connection_age_grace_;
+  bool                     draining_;
+  quic::QuicTime           drain_deadline_;
+
+  quic::QuicBandwidth      connected_udp_threshold_;
+  tQuicSocketCallback      socket_cb_;
+  // Writers of promoted connections, owned by their sessions.
+  std::unordered_map<quic::QuicBlockedWriterInterface*,
+                     tQuicConnectedWriter*> connected_writers_;
+
+  bool                     transport_info_headers_;
+  bool                     deferred_flush_;
+  const tQuicHeaderNameTable* header_names_; // not owned
+
+  tQuicConnectionCallback  conn_cb_;
+
+  tQuicTenantScheduler     tenants_;
+
+  quic::QuicTime::Delta    header_timeout_;
+  quic::QuicTime::Delta    progress_window_;
+  quic::QuicByteCount      min_progress_bytes_;
+
+  bool                     stream_limit_tuning_;
+  uint32_t                 stream_limit_base_;
+  uint32_t                 stream_limit_max_;
+  uint64_t                 max_open_streams_;
+  uint32_t                 stream_limit_target_;
+  bool                     streams_blocked_seen_;
+
+  tQuicConnectionLimiter   limiter_;
+
+  tQuicLogger*             logger_; // not owned
 };
 
 }  // namespace nginx
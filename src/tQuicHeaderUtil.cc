@@ -0,0 +1,393 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define T_QUIC_HEADER_SIMD 1
+#endif
+
+#include "src/tQuicHeaderUtil.hh"
+
+namespace nginx {
+
+namespace {
+
+// tchar = "!" / "#" / "$" / "%" / "&" / "'" / "*" / "+" / "-" / "." /
+//         "^" / "_" / "`" / "|" / "~" / DIGIT / ALPHA
+struct TokenTable {
+  bool    token[256];
+  // For the SIMD lookups: bit h of lo_nibble[l] is set if (h << 4 | l) is
+  // a tchar, ASCII only so h < 8.
+  uint8_t lo_nibble[16];
+
+  TokenTable() : token(), lo_nibble() {
+    const char* specials = "!#$%&'*+-.^_`|~";
+    for (int c = 0; c < 256; c++) {
+      token[c] = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                 (c >= 'A' && c <= 'Z') || (c != 0 && strchr(specials, c) != nullptr);
+      if (token[c]) {
+        lo_nibble[c & 0x0f] |= static_cast<uint8_t>(1 << (c >> 4));
+      }
+    }
+  }
+};
+
+const TokenTable& Tokens() {
+  static const TokenTable table;
+  return table;
+}
+
+tQuicHeaderNameStatus ValidateNameScalar(const unsigned char* p, size_t len) {
+  const bool* token = Tokens().token;
+  bool upper = false;
+  for (size_t i = 0; i < len; i++) {
+    if (!token[p[i]]) {
+      return HEADER_NAME_INVALID;
+    }
+    upper |= (p[i] >= 'A' && p[i] <= 'Z');
+  }
+  return upper ? HEADER_NAME_UPPERCASE : HEADER_NAME_LOWERCASE;
+}
+
+bool ValidateValueScalar(const unsigned char* p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] == '\0' || p[i] == '\r' || p[i] == '\n') {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LowercaseScalar(char* p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] >= 'A' && p[i] <= 'Z') {
+      p[i] += 'a' - 'A';
+    }
+  }
+}
+
+#ifdef T_QUIC_HEADER_SIMD
+
+__attribute__((target("avx2")))
+tQuicHeaderNameStatus ValidateNameAVX2(const unsigned char* p, size_t len) {
+  const __m256i lo_table = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(Tokens().lo_nibble)));
+  // 1 << h for ASCII high nibbles, 0 (no match) for bytes >= 0x80.
+  const __m256i hi_table = _mm256_setr_epi8(
+    1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+  const __m256i before_a = _mm256_set1_epi8('A' - 1);
+  const __m256i after_z = _mm256_set1_epi8('Z' + 1);
+
+  __m256i upper = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble_mask));
+    __m256i hi = _mm256_shuffle_epi8(
+      hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble_mask));
+    __m256i bad = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+    if (!_mm256_testz_si256(bad, bad)) {
+      return HEADER_NAME_INVALID;
+    }
+    upper = _mm256_or_si256(upper, _mm256_and_si256(
+      _mm256_cmpgt_epi8(v, before_a), _mm256_cmpgt_epi8(after_z, v)));
+  }
+
+  tQuicHeaderNameStatus tail = ValidateNameScalar(p + i, len - i);
+  if (tail == HEADER_NAME_INVALID) {
+    return tail;
+  }
+  return (!_mm256_testz_si256(upper, upper) || tail == HEADER_NAME_UPPERCASE)
+           ? HEADER_NAME_UPPERCASE : HEADER_NAME_LOWERCASE;
+}
+
+__attribute__((target("ssse3,sse4.1")))
+tQuicHeaderNameStatus ValidateNameSSE(const unsigned char* p, size_t len) {
+  const __m128i lo_table =
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(Tokens().lo_nibble));
+  const __m128i hi_table = _mm_setr_epi8(
+    1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+  const __m128i before_a = _mm_set1_epi8('A' - 1);
+  const __m128i after_z = _mm_set1_epi8('Z' + 1);
+
+  __m128i upper = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(v, nibble_mask));
+    __m128i hi = _mm_shuffle_epi8(
+      hi_table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble_mask));
+    __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+    if (!_mm_testz_si128(bad, bad)) {
+      return HEADER_NAME_INVALID;
+    }
+    upper = _mm_or_si128(upper, _mm_and_si128(
+      _mm_cmpgt_epi8(v, before_a), _mm_cmpgt_epi8(after_z, v)));
+  }
+
+  tQuicHeaderNameStatus tail = ValidateNameScalar(p + i, len - i);
+  if (tail == HEADER_NAME_INVALID) {
+    return tail;
+  }
+  return (!_mm_testz_si128(upper, upper) || tail == HEADER_NAME_UPPERCASE)
+           ? HEADER_NAME_UPPERCASE : HEADER_NAME_LOWERCASE;
+}
+
+__attribute__((target("avx2")))
+bool ValidateValueAVX2(const unsigned char* p, size_t len) {
+  const __m256i nul = _mm256_setzero_si256();
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    __m256i bad = _mm256_or_si256(_mm256_cmpeq_epi8(v, nul),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+    if (!_mm256_testz_si256(bad, bad)) {
+      return false;
+    }
+  }
+  return ValidateValueScalar(p + i, len - i);
+}
+
+__attribute__((target("sse4.1")))
+bool ValidateValueSSE(const unsigned char* p, size_t len) {
+  const __m128i nul = _mm_setzero_si128();
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(v, nul),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+    if (!_mm_testz_si128(bad, bad)) {
+      return false;
+    }
+  }
+  return ValidateValueScalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+void LowercaseAVX2(char* p, size_t len) {
+  const __m256i before_a = _mm256_set1_epi8('A' - 1);
+  const __m256i after_z = _mm256_set1_epi8('Z' + 1);
+  const __m256i delta = _mm256_set1_epi8('a' - 'A');
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, before_a),
+                                     _mm256_cmpgt_epi8(after_z, v));
+    v = _mm256_add_epi8(v, _mm256_and_si256(upper, delta));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i), v);
+  }
+  LowercaseScalar(p + i, len - i);
+}
+
+// SSE2 is part of x86_64, no target attribute needed.
+void LowercaseSSE(char* p, size_t len) {
+  const __m128i before_a = _mm_set1_epi8('A' - 1);
+  const __m128i after_z = _mm_set1_epi8('Z' + 1);
+  const __m128i delta = _mm_set1_epi8('a' - 'A');
+
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before_a),
+                                  _mm_cmpgt_epi8(after_z, v));
+    v = _mm_add_epi8(v, _mm_and_si128(upper, delta));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), v);
+  }
+  LowercaseScalar(p + i, len - i);
+}
+
+#endif  // T_QUIC_HEADER_SIMD
+
+struct Dispatch {
+  tQuicHeaderNameStatus (*validate_name)(const unsigned char*, size_t);
+  bool (*validate_value)(const unsigned char*, size_t);
+  void (*lowercase)(char*, size_t);
+
+  Dispatch()
+      : validate_name(ValidateNameScalar),
+        validate_value(ValidateValueScalar),
+        lowercase(LowercaseScalar) {
+#ifdef T_QUIC_HEADER_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      validate_name = ValidateNameAVX2;
+      validate_value = ValidateValueAVX2;
+      lowercase = LowercaseAVX2;
+    } else if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")) {
+      validate_name = ValidateNameSSE;
+      validate_value = ValidateValueSSE;
+      lowercase = LowercaseSSE;
+    }
+#endif
+  }
+};
+
+const Dispatch& Impl() {
+  static const Dispatch dispatch;
+  return dispatch;
+}
+
+// Names of the tQuicHeaderId constants, in order.
+const char* const kFixedNames[HEADER_ID_FIXED_COUNT] = {
+  ":authority", ":method", ":path", "host", "content-length", "cookie",
+  "transport-protocol", "alt-svc", "connection", "proxy-connection",
+  "keep-alive", "proxy-authenticate", "proxy-authorization", "te", "trailer",
+  "transfer-encoding", "upgrade", "vary",
+};
+
+// The other names of the QPACK static table (RFC 9204 appendix A).
+const char* const kQpackNames[] = {
+  ":scheme", ":status", "age", "content-disposition", "date", "etag",
+  "if-modified-since", "if-none-match", "last-modified", "link", "location",
+  "referer", "set-cookie", "accept", "accept-encoding", "accept-ranges",
+  "access-control-allow-headers", "access-control-allow-origin",
+  "cache-control", "content-encoding", "content-type", "range",
+  "strict-transport-security", "x-content-type-options", "x-xss-protection",
+  "accept-language", "access-control-allow-credentials",
+  "access-control-allow-methods", "access-control-expose-headers",
+  "access-control-request-headers", "access-control-request-method",
+  "authorization", "content-security-policy", "early-data", "expect-ct",
+  "forwarded", "if-range", "origin", "purpose", "server",
+  "timing-allow-origin", "upgrade-insecure-requests", "user-agent",
+  "x-forwarded-for", "x-frame-options",
+};
+
+inline char LowerASCII(char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// FNV-1a of the lowercased name.
+uint32_t HashName(const char* p, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ static_cast<uint8_t>(LowerASCII(p[i]))) * 16777619u;
+  }
+  return h;
+}
+
+}  // namespace
+
+tQuicHeaderNameStatus ValidateHeaderName(const char* name, size_t len) {
+  if (len == 0) {
+    return HEADER_NAME_INVALID;
+  }
+  // Pseudo header, the rest is a token as well.
+  if (name[0] == ':') {
+    if (len == 1) {
+      return HEADER_NAME_INVALID;
+    }
+    name++;
+    len--;
+  }
+  return Impl().validate_name(reinterpret_cast<const unsigned char*>(name), len);
+}
+
+bool ValidateHeaderValue(const char* value, size_t len) {
+  return Impl().validate_value(reinterpret_cast<const unsigned char*>(value), len);
+}
+
+void LowercaseASCII(char* data, size_t len) {
+  Impl().lowercase(data, len);
+}
+
+tQuicHeaderNameTable::tQuicHeaderNameTable() {
+  names_.reserve(kMaxNames);
+  hashes_.reserve(kMaxNames);
+  for (size_t i = 0; i < kSlots; i++) {
+    slots_[i] = -1;
+  }
+
+  for (const char* name : kFixedNames) {
+    Add(name, strlen(name));
+  }
+  for (const char* name : kQpackNames) {
+    Add(name, strlen(name));
+  }
+}
+
+const tQuicHeaderNameTable& tQuicHeaderNameTable::Default() {
+  static const tQuicHeaderNameTable table;
+  return table;
+}
+
+int tQuicHeaderNameTable::Add(const char* name, size_t len) {
+  if (ValidateHeaderName(name, len) == HEADER_NAME_INVALID) {
+    return HEADER_ID_UNKNOWN;
+  }
+
+  int id = Lookup(name, len);
+  if (id != HEADER_ID_UNKNOWN) {
+    return id;
+  }
+  if (names_.size() >= kMaxNames) {
+    return HEADER_ID_UNKNOWN;
+  }
+
+  uint32_t hash = HashName(name, len);
+  size_t slot = hash & (kSlots - 1);
+  while (slots_[slot] != -1) {
+    slot = (slot + 1) & (kSlots - 1);
+  }
+
+  id = static_cast<int>(names_.size());
+  names_.emplace_back(name, len);
+  LowercaseASCII(&names_.back()[0], len);
+  hashes_.push_back(hash);
+  slots_[slot] = static_cast<int16_t>(id);
+  return id;
+}
+
+int tQuicHeaderNameTable::AddList(const char* names) {
+  int added = 0;
+  while (names != nullptr && *names != '\0') {
+    const char* end = strchr(names, ',');
+    size_t len = end ? static_cast<size_t>(end - names) : strlen(names);
+
+    // Trim the blanks around the name.
+    const char* start = names;
+    while (len > 0 && (*start == ' ' || *start == '\t')) {
+      start++;
+      len--;
+    }
+    while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t')) {
+      len--;
+    }
+    if (len > 0 && Add(start, len) != HEADER_ID_UNKNOWN) {
+      added++;
+    }
+
+    names = end ? end + 1 : nullptr;
+  }
+  return added;
+}
+
+int tQuicHeaderNameTable::Lookup(const char* name, size_t len) const {
+  uint32_t hash = HashName(name, len);
+  for (size_t slot = hash & (kSlots - 1); slots_[slot] != -1;
+       slot = (slot + 1) & (kSlots - 1)) {
+    int id = slots_[slot];
+    if (hashes_[id] != hash || names_[id].size() != len) {
+      continue;
+    }
+    const char* interned = names_[id].data();
+    size_t i = 0;
+    while (i < len && interned[i] == LowerASCII(name[i])) {
+      i++;
+    }
+    if (i == len) {
+      return id;
+    }
+  }
+  return HEADER_ID_UNKNOWN;
+}
+
+}  // namespace nginx
@@ -0,0 +1,108 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack request header validation helpers.
+
+#ifndef _NGINX_T_QUIC_HEADER_UTIL_H_
+#define _NGINX_T_QUIC_HEADER_UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace nginx {
+
+// Result of ValidateHeaderName().
+enum tQuicHeaderNameStatus {
+  HEADER_NAME_INVALID   = -1,
+  HEADER_NAME_LOWERCASE = 0,
+  HEADER_NAME_UPPERCASE = 1, // valid once lowercased
+};
+
+// Checks |name| is an RFC 9110 token, after the leading ':' of a pseudo
+// header, and whether it holds upper case letters. Uses AVX2 or SSSE3 when
+// the CPU has them, picked once at first use.
+tQuicHeaderNameStatus ValidateHeaderName(const char* name, size_t len);
+
+// Checks a field value holds no NUL, CR or LF (RFC 9114 section 4.1.2).
+bool ValidateHeaderValue(const char* value, size_t len);
+
+// Lowercases ASCII letters of |data| in place.
+void LowercaseASCII(char* data, size_t len);
+
+// Ids of the names every tQuicHeaderNameTable starts with. The first ones
+// are handled by the stack itself, followed by the hop-by-hop names dropped
+// from responses. The rest of the QPACK static table names and the
+// configured ones come after HEADER_ID_FIXED_COUNT, without constants.
+enum tQuicHeaderId {
+  HEADER_ID_UNKNOWN = -1,
+  HEADER_ID_AUTHORITY = 0,
+  HEADER_ID_METHOD,
+  HEADER_ID_PATH,
+  HEADER_ID_HOST,
+  HEADER_ID_CONTENT_LENGTH,
+  HEADER_ID_COOKIE,
+  HEADER_ID_TRANSPORT_PROTOCOL,
+  HEADER_ID_ALT_SVC,
+  HEADER_ID_CONNECTION,
+  HEADER_ID_PROXY_CONNECTION,
+  HEADER_ID_KEEP_ALIVE,
+  HEADER_ID_PROXY_AUTHENTICATE,
+  HEADER_ID_PROXY_AUTHORIZATION,
+  HEADER_ID_TE,
+  HEADER_ID_TRAILER,
+  HEADER_ID_TRANSFER_ENCODING,
+  HEADER_ID_UPGRADE,
+  HEADER_ID_VARY,
+  HEADER_ID_FIXED_COUNT,
+
+  HEADER_ID_HOP_FIRST = HEADER_ID_ALT_SVC,
+  HEADER_ID_HOP_LAST = HEADER_ID_VARY,
+};
+
+// Stack wide table of interned lowercase header names, so the header paths
+// compare small integer ids and never allocate known names. Names are only
+// added at setup, lookups are then safe from any thread.
+class tQuicHeaderNameTable {
+ public:
+  static const size_t kMaxNames = 256;
+
+  // Starts with the tQuicHeaderId names and the QPACK static table ones.
+  tQuicHeaderNameTable();
+  tQuicHeaderNameTable(const tQuicHeaderNameTable&) = delete;
+  tQuicHeaderNameTable& operator=(const tQuicHeaderNameTable&) = delete;
+
+  // Table with the built in names only.
+  static const tQuicHeaderNameTable& Default();
+
+  // Interns |name| lowercased, returns its id, or HEADER_ID_UNKNOWN if it
+  // is not a valid name or the table is full.
+  int Add(const char* name, size_t len);
+
+  // Interns the names of a comma separated list, returns how many were
+  // added or already known.
+  int AddList(const char* names);
+
+  // Id of |name|, matched case-insensitively.
+  int Lookup(const char* name, size_t len) const;
+
+  // Lowercase name of a valid id, stable for the lifetime of the table.
+  const std::string& Name(int id) const { return names_[id]; }
+
+  size_t size() const { return names_.size(); }
+
+  static bool IsHopHeader(int id) {
+    return id >= HEADER_ID_HOP_FIRST && id <= HEADER_ID_HOP_LAST;
+  }
+
+ private:
+  static const size_t kSlots = 1024; // power of two, >= 2 * kMaxNames
+
+  std::vector<std::string> names_;  // capacity reserved, never reallocated
+  std::vector<uint32_t>    hashes_;
+  int16_t                  slots_[kSlots]; // ids by hash, -1 if empty
+};
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_HEADER_UTIL_H_
@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <chrono>
+
+#include "src/tQuicLog.hh"
+
+namespace nginx {
+
+namespace {
+  const char* const kLevelNames[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+  const char* const kModuleNames[] = {
+    "stack", "dispatcher", "session", "stream", "writer", "crypto"
+  };
+  static_assert(sizeof(kModuleNames) / sizeof(kModuleNames[0]) == QUIC_LOG_MODULE_MAX,
+                "log module names out of sync with QUIC_LOG_MODULE_*");
+
+  // The flusher sleeps this long when the ring is empty.
+  const int kFlushIntervalMs = 50;
+
+  int64_t WallTimeInUsec() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+}
+
+tQuicLogger::tQuicLogger(tQuicStackStats* stats)
+    : stats_(stats),
+      head_(0),
+      tail_(0),
+      file_(nullptr),
+      stopping_(false) {
+  for (int i = 0; i < QUIC_LOG_MODULE_MAX; i++) {
+    levels_[i].store(QUIC_LOG_WARN, std::memory_order_relaxed);
+  }
+  callback_.OnLog = nullptr;
+  callback_.LogContext = nullptr;
+}
+
+tQuicLogger::~tQuicLogger() {
+  if (flusher_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(flusher_mutex_);
+      stopping_ = true;
+    }
+    flusher_cv_.notify_one();
+    flusher_.join();
+  }
+
+  Drain();
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+bool tQuicLogger::SetFile(const char* path) {
+  FILE* file = fopen(path, "a");
+  if (file == nullptr) {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    if (file_ != nullptr) {
+      fclose(file_);
+    }
+    file_ = file;
+  }
+  StartFlusher();
+  return true;
+}
+
+void tQuicLogger::SetCallback(tQuicLogCallback cb) {
+  {
+    std::lock_guard<std::mutex> lock(sink_mutex_);
+    callback_ = cb;
+  }
+  if (cb.OnLog != nullptr) {
+    StartFlusher();
+  }
+}
+
+void tQuicLogger::SetLevel(int module, int level) {
+  if (module < 0) {
+    for (int i = 0; i < QUIC_LOG_MODULE_MAX; i++) {
+      levels_[i].store(level, std::memory_order_relaxed);
+    }
+    return;
+  }
+  if (module < QUIC_LOG_MODULE_MAX) {
+    levels_[module].store(level, std::memory_order_relaxed);
+  }
+}
+
+void tQuicLogger::Log(int module, int level, tQuicLogSite* site, const char* fmt, ...) {
+  int64_t now_us = WallTimeInUsec();
+  int64_t now_sec = now_us / 1000000;
+  if (site->window_start_sec != now_sec) {
+    site->window_start_sec = now_sec;
+    site->count = 0;
+  }
+  if (++site->count > tQuicLogSite::kMaxPerSecond) {
+    site->suppressed++;
+    stats_->log_suppressed++;
+    return;
+  }
+
+  size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) >= kNumSlots) {
+    stats_->log_dropped++;
+    return;
+  }
+
+  Slot& slot = slots_[tail & (kNumSlots - 1)];
+  slot.time_us = now_us;
+  slot.module  = static_cast<uint8_t>(module);
+  slot.level   = static_cast<uint8_t>(level);
+
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(slot.data, kMaxLineLength, fmt, args);
+  va_end(args);
+  if (n < 0) {
+    return;
+  }
+  size_t len = std::min(static_cast<size_t>(n), kMaxLineLength - 1);
+
+  if (site->suppressed > 0 && len < kMaxLineLength - 1) {
+    int m = snprintf(slot.data + len, kMaxLineLength - len,
+                     " (%u suppressed)", site->suppressed);
+    if (m > 0) {
+      len = std::min(len + m, kMaxLineLength - 1);
+    }
+    site->suppressed = 0;
+  }
+  slot.len = static_cast<uint16_t>(len);
+
+  tail_.store(tail + 1, std::memory_order_release);
+}
+
+void tQuicLogger::StartFlusher() {
+  if (!flusher_.joinable()) {
+    flusher_ = std::thread(&tQuicLogger::FlusherLoop, this);
+  }
+}
+
+void tQuicLogger::FlusherLoop() {
+  std::unique_lock<std::mutex> lock(flusher_mutex_);
+  while (!stopping_) {
+    lock.unlock();
+    size_t written = Drain();
+    lock.lock();
+    if (written == 0) {
+      flusher_cv_.wait_for(lock, std::chrono::milliseconds(kFlushIntervalMs));
+    }
+  }
+}
+
+size_t tQuicLogger::Drain() {
+  std::lock_guard<std::mutex> lock(sink_mutex_);
+  if (file_ == nullptr && callback_.OnLog == nullptr) {
+    return 0;
+  }
+
+  size_t head = head_.load(std::memory_order_relaxed);
+  size_t tail = tail_.load(std::memory_order_acquire);
+  for (size_t i = head; i != tail; i++) {
+    Write(slots_[i & (kNumSlots - 1)]);
+  }
+  head_.store(tail, std::memory_order_release);
+
+  if (file_ != nullptr && tail != head) {
+    fflush(file_);
+  }
+  return tail - head;
+}
+
+void tQuicLogger::Write(const Slot& slot) {
+  if (callback_.OnLog != nullptr) {
+    callback_.OnLog(slot.module, slot.level, slot.data, slot.len, callback_.LogContext);
+  }
+  if (file_ == nullptr) {
+    return;
+  }
+
+  time_t sec = static_cast<time_t>(slot.time_us / 1000000);
+  struct tm tm;
+  localtime_r(&sec, &tm);
+  char time_str[32];
+  strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+
+  fprintf(file_, "[%s.%06d] [%s] [%s] %.*s\n",
+          time_str, static_cast<int>(slot.time_us % 1000000),
+          slot.level < 4 ? kLevelNames[slot.level] : "TRACE",
+          kModuleNames[slot.module],
+          static_cast<int>(slot.len), slot.data);
+}
+
+}  // namespace nginx
@@ -0,0 +1,108 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack asynchronous logger class.
+
+#ifndef _NGINX_T_QUIC_LOG_H_
+#define _NGINX_T_QUIC_LOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "src/quic_stack_api.h"
+
+namespace nginx {
+
+// Per log site state of TQUIC_LOG, at most kMaxPerSecond lines a second
+// are emitted, the others are counted and reported with the next line.
+struct tQuicLogSite {
+  static const uint32_t kMaxPerSecond = 10;
+
+  int64_t  window_start_sec;
+  uint32_t count;
+  uint32_t suppressed;
+};
+
+// Logger of one stack. The stack thread formats lines into a lock-free
+// single producer single consumer ring, a background thread drains it to
+// the file or host callback sink so logging never blocks the event loop.
+// Lines are dropped, and counted, when the ring is full.
+class tQuicLogger {
+ public:
+  explicit tQuicLogger(tQuicStackStats* stats);
+  tQuicLogger(const tQuicLogger&) = delete;
+  tQuicLogger& operator=(const tQuicLogger&) = delete;
+  ~tQuicLogger();
+
+  // Sinks, setting one starts the flusher thread. Lines logged before are
+  // kept in the ring.
+  bool SetFile(const char* path);
+  void SetCallback(tQuicLogCallback cb);
+
+  // |module| < 0 sets every module.
+  void SetLevel(int module, int level);
+
+  bool IsEnabled(int module, int level) const {
+    return module >= 0 && module < QUIC_LOG_MODULE_MAX &&
+           level <= levels_[module].load(std::memory_order_relaxed);
+  }
+
+  // Formats and queues one line, called from the stack thread only.
+  void Log(int module, int level, tQuicLogSite* site, const char* fmt, ...)
+      __attribute__((format(printf, 5, 6)));
+
+ private:
+  static const size_t kNumSlots = 4096;   // power of two
+  static const size_t kMaxLineLength = 240;
+
+  struct Slot {
+    int64_t  time_us;
+    uint8_t  module;
+    uint8_t  level;
+    uint16_t len;
+    char     data[kMaxLineLength];
+  };
+
+  void StartFlusher();
+  void FlusherLoop();
+  // Writes out every queued line, returns the number written.
+  size_t Drain();
+  void Write(const Slot& slot);
+
+  tQuicStackStats*       stats_;
+  std::atomic<int>       levels_[QUIC_LOG_MODULE_MAX];
+
+  Slot                   slots_[kNumSlots];
+  std::atomic<size_t>    head_; // next slot to read, owned by the flusher
+  std::atomic<size_t>    tail_; // next slot to write, owned by the stack thread
+
+  std::mutex             sink_mutex_;
+  FILE*                  file_;
+  tQuicLogCallback       callback_;
+
+  std::thread            flusher_;
+  std::mutex             flusher_mutex_;
+  std::condition_variable flusher_cv_;
+  bool                   stopping_;
+};
+
+}  // namespace nginx
+
+// Rate limited log line, e.g.
+//   TQUIC_LOG(logger, QUIC_LOG_MODULE_SESSION, QUIC_LOG_WARN, "closed %d", rc);
+// Arguments are not evaluated when the level is disabled.
+#define TQUIC_LOG(logger, module, level, ...)                           \
+  do {                                                                  \
+    nginx::tQuicLogger* tquic_logger_ = (logger);                       \
+    if (tquic_logger_ != nullptr &&                                     \
+        tquic_logger_->IsEnabled((module), (level))) {                  \
+      static thread_local nginx::tQuicLogSite tquic_log_site_ = {0, 0, 0}; \
+      tquic_logger_->Log((module), (level), &tquic_log_site_, __VA_ARGS__); \
+    }                                                                   \
+  } while (0)
+
+#endif  // _NGINX_T_QUIC_LOG_H_
@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+
+#include "src/tQuicPoller.hh"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+using namespace quic;
+
+namespace nginx {
+
+tQuicPoller::tQuicPoller() {
+  for (int i = 0; i < kNumPacketsPerRead; i++) {
+    iovs_[i].iov_base = buffers_[i];
+    iovs_[i].iov_len  = sizeof(buffers_[i]);
+  }
+}
+
+void tQuicPoller::AddSocket(int fd, int busy_poll_us) {
+  for (const Socket& socket : sockets_) {
+    if (socket.fd == fd) {
+      return;
+    }
+  }
+
+  if (busy_poll_us > 0) {
+    // Best effort, values above net.core.busy_read need CAP_NET_ADMIN.
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us));
+  }
+
+  Socket socket;
+  socket.fd = fd;
+  sockaddr_storage ss;
+  socklen_t len = sizeof(ss);
+  if (getsockname(fd, reinterpret_cast<sockaddr*>(&ss), &len) == 0) {
+    socket.local_address = QuicSocketAddress(ss);
+  }
+  sockets_.push_back(socket);
+}
+
+int tQuicPoller::PollOnce(const PacketHandler& handler) {
+  int packets = 0;
+  for (const Socket& socket : sockets_) {
+    packets += ReadSocket(socket, handler);
+  }
+  return packets;
+}
+
+int tQuicPoller::ReadSocket(const Socket& socket, const PacketHandler& handler) {
+  for (int i = 0; i < kNumPacketsPerRead; i++) {
+    struct msghdr* hdr = &mmsgs_[i].msg_hdr;
+    hdr->msg_name       = &peers_[i];
+    hdr->msg_namelen    = sizeof(peers_[i]);
+    hdr->msg_iov        = &iovs_[i];
+    hdr->msg_iovlen     = 1;
+    hdr->msg_control    = cbufs_[i];
+    hdr->msg_controllen = kCmsgSpace;
+    hdr->msg_flags      = 0;
+    mmsgs_[i].msg_len   = 0;
+  }
+
+  int n;
+  do {
+    n = recvmmsg(socket.fd, mmsgs_, kNumPacketsPerRead, MSG_DONTWAIT, nullptr);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    return 0;
+  }
+
+  for (int i = 0; i < n; i++) {
+    struct msghdr* hdr = &mmsgs_[i].msg_hdr;
+    if (hdr->msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+      continue;
+    }
+
+    QuicSocketAddress self_addr(socket.local_address);
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+      if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+        in_pktinfo info;
+        memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+        self_addr = QuicSocketAddress(QuicIpAddress(info.ipi_addr),
+                                      socket.local_address.port());
+        break;
+      }
+      if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+        in6_pktinfo info;
+        memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+        self_addr = QuicSocketAddress(QuicIpAddress(info.ipi6_addr),
+                                      socket.local_address.port());
+        break;
+      }
+    }
+
+    handler(self_addr, QuicSocketAddress(peers_[i]), buffers_[i], mmsgs_[i].msg_len);
+  }
+  return n;
+}
+
+}  // namespace nginx
@@ -0,0 +1,62 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack busy polling packet reader class.
+
+#ifndef _NGINX_T_QUIC_POLLER_H_
+#define _NGINX_T_QUIC_POLLER_H_
+
+#include <sys/socket.h>
+
+#include <functional>
+#include <vector>
+
+#include "quic/core/quic_constants.h"
+#include "quic/platform/api/quic_socket_address.h"
+
+namespace nginx {
+
+// Reads the stack sockets with recvmmsg in a tight loop, for hosts trading
+// CPU for the latency of an epoll wakeup. The destination address of each
+// packet comes from IP_PKTINFO/IPV6_PKTINFO, or the socket local address
+// when the socket is not bound to a wildcard address.
+class tQuicPoller {
+ public:
+  typedef std::function<void(const quic::QuicSocketAddress& self_addr,
+                             const quic::QuicSocketAddress& peer_addr,
+                             char* buffer, size_t length)> PacketHandler;
+
+  tQuicPoller();
+  tQuicPoller(const tQuicPoller&) = delete;
+  tQuicPoller& operator=(const tQuicPoller&) = delete;
+
+  // Registers |fd| and enables SO_BUSY_POLL on it when |busy_poll_us| > 0.
+  void AddSocket(int fd, int busy_poll_us);
+
+  // Reads one batch from every socket, hands each packet to |handler| and
+  // returns the number of packets read.
+  int PollOnce(const PacketHandler& handler);
+
+  bool empty() const { return sockets_.empty(); }
+
+ private:
+  static const int kNumPacketsPerRead = 16;
+  static const size_t kCmsgSpace = 128;
+
+  struct Socket {
+    int fd;
+    quic::QuicSocketAddress local_address;
+  };
+
+  int ReadSocket(const Socket& socket, const PacketHandler& handler);
+
+  std::vector<Socket> sockets_;
+
+  char          buffers_[kNumPacketsPerRead][quic::kMaxIncomingPacketSize];
+  char          cbufs_[kNumPacketsPerRead][kCmsgSpace];
+  sockaddr_storage peers_[kNumPacketsPerRead];
+  struct iovec  iovs_[kNumPacketsPerRead];
+  struct mmsghdr mmsgs_[kNumPacketsPerRead];
+};
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_POLLER_H_
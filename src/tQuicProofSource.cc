@@ -1,5 +1,9 @@
 #include "src/tQuicProofSource.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include "base/strings/pattern.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/files/file_util.h"
@@ -32,6 +36,23 @@ tQuicProofSource::~tQuicProofSource() {}
 bool tQuicProofSource::AddCertificateChainFromPath(
   const base::FilePath& cert_path,
   const base::FilePath& key_path) {
+  quic::QuicReferenceCountedPointer<Chain> chain;
+  std::unique_ptr<quic::CertificatePrivateKey> private_key;
+  std::vector<std::string> hosts;
+  if (!LoadCertificateChain(cert_path, key_path, &chain, &private_key, &hosts)) {
+    return false;
+  }
+
+  AddLoadedCertificateChain(chain, std::move(private_key), hosts);
+  return true;
+}
+
+bool tQuicProofSource::LoadCertificateChain(
+  const base::FilePath& cert_path,
+  const base::FilePath& key_path,
+  quic::QuicReferenceCountedPointer<Chain>* chain,
+  std::unique_ptr<quic::CertificatePrivateKey>* key,
+  std::vector<std::string>* hosts) {
   CRYPTO_library_init();
 
   std::string cert_data;
@@ -43,8 +64,10 @@ bool tQuicProofSource::AddCertificateChainFromPath(
   std::stringstream cert_stream(cert_data);
   std::vector<std::string> certs =
        quic::CertificateView::LoadPemFromStream(&cert_stream);
-
-  quic::QuicReferenceCountedPointer<quic::ProofSource::Chain> chain(new quic::ProofSource::Chain(certs));
+  if (certs.empty()) {
+    QUIC_BUG(-1) << "Empty certificate chain supplied.";
+    return false;
+  }
 
   std::string key_data;
   if (!base::ReadFileToString(key_path, &key_data)) {
@@ -56,9 +79,78 @@ bool tQuicProofSource::AddCertificateChainFromPath(
   std::unique_ptr<quic::CertificatePrivateKey> private_key = quic::CertificatePrivateKey::LoadPemFromStream(&key_stream);
   if (private_key == nullptr) {
     QUIC_BUG(-1) << "default key is null.";
+    return false;
+  }
+
+  std::unique_ptr<CertificateView> leaf =
+      CertificateView::ParseSingleCertificate(certs[0]);
+  if (leaf == nullptr) {
+    QUIC_BUG(-1) << "Unable to parse X.509 leaf certificate in the supplied chain.";
+    return false;
+  }
+  if (!private_key->MatchesPublicKey(*leaf)) {
+    QUIC_BUG(-1) << "Private key does not match the leaf certificate.";
+    return false;
+  }
+
+  hosts->clear();
+  for (quiche::QuicheStringPiece host : leaf->subject_alt_name_domains()) {
+    hosts->push_back(std::string(host));
+  }
+  *chain = quic::QuicReferenceCountedPointer<Chain>(new Chain(certs));
+  *key = std::move(private_key);
+  return true;
+}
+
+void tQuicProofSource::LoadCertificateChains(
+  const std::vector<std::pair<std::string, std::string>>& paths,
+  int threads,
+  std::vector<LoadedChain>* loaded) {
+  CRYPTO_library_init();
+  loaded->clear();
+  loaded->resize(paths.size());
+
+  // Workers take the next index, every slot is written by one thread only.
+  std::atomic<size_t> next(0);
+  auto load = [&paths, loaded, &next]() {
+    for (size_t i = next++; i < paths.size(); i = next++) {
+      LoadedChain& slot = (*loaded)[i];
+      slot.ok = LoadCertificateChain(base::FilePath(paths[i].first),
+                                     base::FilePath(paths[i].second),
+                                     &slot.chain, &slot.key, &slot.hosts);
+    }
+  };
+
+  if (threads <= 0) {
+    threads = std::max<int>(std::thread::hardware_concurrency(), 1);
   }
+  size_t extra = std::min<size_t>(threads, paths.size());
+  extra = extra > 0 ? extra - 1 : 0;
 
-  return AddCertificateChain(chain, std::move(*private_key));
+  std::vector<std::thread> workers;
+  workers.reserve(extra);
+  for (size_t i = 0; i < extra; i++) {
+    workers.emplace_back(load);
+  }
+  load();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+void tQuicProofSource::AddLoadedCertificateChain(
+    QuicReferenceCountedPointer<Chain> chain,
+    std::shared_ptr<const CertificatePrivateKey> key,
+    const std::vector<std::string>& hosts) {
+  certificates_.push_front(Certificate{
+      chain,
+      std::move(key),
+  });
+  Certificate* certificate = &certificates_.front();
+
+  for (const std::string& host : hosts) {
+    certificate_map_[host] = certificate;
+  }
 }
 
 absl::InlinedVector<uint16_t, 8>
@@ -94,7 +186,7 @@ void tQuicProofSource::GetProof(
   }
 
   Certificate* certificate = GetCertificate(hostname);
-  proof.signature = certificate->key.Sign(
+  proof.signature = certificate->key->Sign(
       quiche::QuicheStringPiece(payload.get(), payload_size),
       SSL_SIGN_RSA_PSS_RSAE_SHA256);
   callback->Run(/*ok=*/!proof.signature.empty(), certificate->chain, proof,
@@ -117,7 +209,7 @@ void tQuicProofSource::ComputeTlsSignature(
     quiche::QuicheStringPiece in,
     std::unique_ptr<ProofSource::SignatureCallback> callback) {
   std::string signature =
-      GetCertificate(hostname)->key.Sign(in, signature_algorithm);
+      GetCertificate(hostname)->key->Sign(in, signature_algorithm);
   callback->Run(/*ok=*/!signature.empty(), signature, nullptr);
 }
 
@@ -142,7 +234,7 @@ bool tQuicProofSource::AddCertificateChain(
 
   certificates_.push_front(Certificate{
       chain,
-      std::move(key),
+      std::make_shared<const CertificatePrivateKey>(std::move(key)),
   });
   Certificate* certificate = &certificates_.front();
 
@@ -4,7 +4,9 @@
 #ifndef _NGINX_T_QUIC_PROOF_SOURCE_H_
 #define _NGINX_T_QUIC_PROOF_SOURCE_H_
 
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "src/tQuicClock.hh"
@@ -28,6 +30,37 @@ class tQuicProofSource : public quic::ProofSource {
   bool AddCertificateChainFromPath(const base::FilePath& cert_path,
                                    const base::FilePath& key_path);
 
+  // Reads and checks the chain in |cert_path| and its key in |key_path|,
+  // |hosts| are the SubjectAltName values of the leaf.
+  static bool LoadCertificateChain(
+      const base::FilePath& cert_path,
+      const base::FilePath& key_path,
+      quic::QuicReferenceCountedPointer<Chain>* chain,
+      std::unique_ptr<quic::CertificatePrivateKey>* key,
+      std::vector<std::string>* hosts);
+
+  // A chain of LoadCertificateChains(), |ok| is false if it failed.
+  struct LoadedChain {
+    quic::QuicReferenceCountedPointer<Chain> chain;
+    std::unique_ptr<quic::CertificatePrivateKey> key;
+    std::vector<std::string> hosts;
+    bool ok = false;
+  };
+
+  // LoadCertificateChain() of every (cert, key) path pair on up to
+  // |threads| threads, |loaded| is in the order of |paths|.
+  static void LoadCertificateChains(
+      const std::vector<std::pair<std::string, std::string>>& paths,
+      int threads,
+      std::vector<LoadedChain>* loaded);
+
+  // Adds a chain loaded by LoadCertificateChain(), the key is shared with
+  // the other proof sources using it.
+  void AddLoadedCertificateChain(
+      quic::QuicReferenceCountedPointer<Chain> chain,
+      std::shared_ptr<const quic::CertificatePrivateKey> key,
+      const std::vector<std::string>& hosts);
+
   ProofSource::TicketCrypter* GetTicketCrypter() override;
 
   // ProofSource implementation.
@@ -61,7 +94,7 @@ class tQuicProofSource : public quic::ProofSource {
  private:
   struct Certificate {
     quic::QuicReferenceCountedPointer<Chain> chain;
-    quic::CertificatePrivateKey key;
+    std::shared_ptr<const quic::CertificatePrivateKey> key;
   };
 
   // Looks up certficiate for hostname, returns the default if no certificate is
@@ -1,3 +1,7 @@
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
 #include <utility>
 
 #include "quic/core/quic_connection.h"
@@ -5,6 +9,8 @@
 #include "quic/core/quic_session.h"
 #include "quic/platform/api/quic_flags.h"
 #include "quic/platform/api/quic_logging.h"
+#include "src/tQuicDeferredWriter.hh"
+#include "src/tQuicDispatcher.hh"
 #include "src/tQuicServerSession.hh"
 #include "src/tQuicServerStream.hh"
 
@@ -12,11 +18,33 @@ using namespace quic;
 
 namespace nginx {
 
+class tQuicServerSession::DrainAlarmDelegate : public QuicAlarm::Delegate {
+ public:
+  explicit DrainAlarmDelegate(tQuicServerSession* session)
+      : session_(session) {}
+
+  void OnAlarm() override { session_->OnDrainAlarm(); }
+
+ private:
+  tQuicServerSession* session_;
+};
+
+class tQuicServerSession::ProgressAlarmDelegate : public QuicAlarm::Delegate {
+ public:
+  explicit ProgressAlarmDelegate(tQuicServerSession* session)
+      : session_(session) {}
+
+  void OnAlarm() override { session_->OnProgressAlarm(); }
+
+ private:
+  tQuicServerSession* session_;
+};
+
 tQuicServerSession::tQuicServerSession(
     const QuicConfig& config,
     const ParsedQuicVersionVector& supported_versions,
     QuicConnection* connection,
-    QuicSession::Visitor* visitor,
+    tQuicDispatcher* dispatcher,
     QuicCryptoServerStream::Helper* helper,
     const QuicCryptoServerConfig* crypto_config,
     QuicCompressedCertsCache* compressed_certs_cache,
@@ -26,26 +54,506 @@ tQuicServerSession::tQuicServerSession(
     : QuicServerSessionBase(config,
                             supported_versions,
                             connection,
-                            visitor,
+                            dispatcher,
                             helper,
                             crypto_config,
                             compressed_certs_cache),
+      dispatcher_(dispatcher),
       stack_ctx_(stack_ctx),
       callback_(cb),
-      qsi_mgr_(qsi_ptr) {
+      qsi_mgr_(qsi_ptr),
+      drain_alarm_(dispatcher->GetAlarmFactory()->CreateAlarm(
+          new DrainAlarmDelegate(this))),
+      draining_(false),
+      drain_deadline_(QuicTime::Zero()),
+      max_age_grace_(QuicTime::Delta::Zero()),
+      progress_alarm_(dispatcher->GetAlarmFactory()->CreateAlarm(
+          new ProgressAlarmDelegate(this))),
+      rate_sample_time_(QuicTime::Zero()),
+      rate_sample_bytes_(0),
+      max_delivery_rate_(QuicBandwidth::Zero()),
+      delivery_burst_end_(0),
+      delivery_rate_applied_(false),
+      tenant_(nullptr),
+      pacing_cap_(QuicBandwidth::Zero()),
+      open_request_streams_(0),
+      connection_ctx_(nullptr),
+      connection_opened_(false),
+      handshake_notified_(false),
+      rejected_(false) {
 }
 
 tQuicServerSession::~tQuicServerSession() {
+  drain_alarm_->Cancel();
+  progress_alarm_->Cancel();
   delete connection();
+  // The dispatcher members are gone when it destroys its sessions, so the
+  // socket is only closed here, the dispatcher demoted them before.
+  connected_writer_.reset();
 }
 
 void tQuicServerSession::SetDefaultEncryptionLevel(EncryptionLevel level) {
   QuicSession::SetDefaultEncryptionLevel(level);
+  // TLS reaches forward secure keys before the handshake is complete, it is
+  // reported from OnTlsHandshakeComplete() instead.
+  if (level == ENCRYPTION_FORWARD_SECURE &&
+      connection()->version().handshake_protocol == PROTOCOL_QUIC_CRYPTO) {
+    OnHandshakeDone();
+  }
 }
 
 void tQuicServerSession::OnTlsHandshakeComplete()
 {
   QuicSession::OnTlsHandshakeComplete();
+  OnHandshakeDone();
+}
+
+tQuicLogger* tQuicServerSession::logger() const
+{
+  return dispatcher_->logger();
+}
+
+void tQuicServerSession::OnConnectionOpen()
+{
+  const tQuicConnectionCallback& conn_cb = dispatcher_->connection_callback();
+  if (conn_cb.OnConnectionOpen == nullptr) {
+    connection_opened_ = true;
+    return;
+  }
+
+  tQuicRequestID id;
+  sockaddr_storage self_ss, peer_ss;
+  SetConnectionRequestID(&id, &self_ss, &peer_ss);
+  int rc = conn_cb.OnConnectionOpen(&id, &connection_ctx_, conn_cb.ConnectionContext);
+  if (rc == QUIC_STACK_OK) {
+    connection_opened_ = true;
+  } else {
+    // No OnConnectionClose either, the host did not take the connection.
+    // Closed from the alarm, the dispatcher does not know the session yet.
+    rejected_ = true;
+    dispatcher_->stats()->connections_rejected++;
+    TQUIC_LOG(dispatcher_->logger(), QUIC_LOG_MODULE_SESSION, QUIC_LOG_INFO,
+              "connection from %s rejected by host: %d",
+              connection()->peer_address().ToString().c_str(), rc);
+    drain_alarm_->Update(connection()->clock()->ApproximateNow(),
+                         QuicTime::Delta::Zero());
+  }
+}
+
+void tQuicServerSession::OnHandshakeDone()
+{
+  if (handshake_notified_ || rejected_) {
+    return;
+  }
+  handshake_notified_ = true;
+
+  const std::string& sni = GetCryptoStream()->crypto_negotiated_params().sni;
+  tQuicServerIdentify* qsi =
+    sni.empty() ? nullptr : qsi_mgr_->GetServerIdentifyByName(sni);
+
+  // Egress is shared out by server context from now on.
+  dispatcher_->tenants()->Assign(this, qsi ? qsi->ctx.server_conf : nullptr);
+
+  const tQuicConnectionCallback& conn_cb = dispatcher_->connection_callback();
+  if (conn_cb.OnHandshakeComplete == nullptr) {
+    return;
+  }
+
+  tQuicRequestID id;
+  sockaddr_storage self_ss, peer_ss;
+  SetConnectionRequestID(&id, &self_ss, &peer_ss);
+  conn_cb.OnHandshakeComplete(&id, sni.data(), sni.size(),
+                              qsi ? &qsi->ctx : nullptr,
+                              connection_ctx_, conn_cb.ConnectionContext);
+}
+
+void tQuicServerSession::SetConnectionRequestID(
+  tQuicRequestID* id, sockaddr_storage* self_ss, sockaddr_storage* peer_ss)
+{
+  memset(id, 0, sizeof(*id));
+  QuicConnectionId cid = connection_id();
+  memcpy(id->connection_data, cid.data(), cid.length());
+  id->connection_len = cid.length();
+  id->stream_id      = 0;
+  id->connection_ctx = connection_ctx_;
+
+  *self_ss = self_address().generic_address();
+  *peer_ss = peer_address().Normalized().generic_address();
+  id->self_sockaddr = reinterpret_cast<sockaddr*>(self_ss);
+  id->self_socklen  = self_ss->ss_family == AF_INET6 ? sizeof(sockaddr_in6)
+                                                     : sizeof(sockaddr_in);
+  id->peer_sockaddr = reinterpret_cast<sockaddr*>(peer_ss);
+  id->peer_socklen  = peer_ss->ss_family == AF_INET6 ? sizeof(sockaddr_in6)
+                                                     : sizeof(sockaddr_in);
+}
+
+bool tQuicServerSession::AllowSelfAddressChange() const
+{
+  // quiche asks through a const interface, but an accepted change also
+  // moves the connection to the writer of its new local address.
+  return dispatcher_->AllowSelfAddressChange(
+    const_cast<tQuicServerSession*>(this)->connection());
+}
+
+void tQuicServerSession::OnConnectionMigration(AddressChangeType type)
+{
+  QuicServerSessionBase::OnConnectionMigration(type);
+
+  if (type == NO_CHANGE) {
+    return;
+  }
+  if (type == PORT_CHANGE) {
+    dispatcher_->stats()->peer_nat_rebindings++;
+  } else {
+    dispatcher_->stats()->peer_migrations++;
+  }
+
+  // The connected socket is bound to the old path.
+  DemoteFromConnectedUdp();
+
+  PerformActionOnActiveStreams([](QuicStream* stream) {
+    if (!stream->is_static()) {
+      static_cast<tQuicServerStream*>(stream)->OnPeerAddressChanged();
+    }
+    return true;
+  });
+}
+
+void tQuicServerSession::OnStreamClosed(QuicStreamId stream_id)
+{
+  QuicStream* stream = GetActiveStream(stream_id);
+  if (stream != nullptr && !stream->is_static() &&
+      stream->type() == BIDIRECTIONAL && open_request_streams_ > 0) {
+    open_request_streams_--;
+    dispatcher_->OnRequestStreamsClosed(1);
+  }
+  QuicServerSessionBase::OnStreamClosed(stream_id);
+
+  // Close from the alarm rather than from within the stream teardown.
+  if (draining_ && GetNumActiveStreams() == 0) {
+    drain_alarm_->Update(connection()->clock()->ApproximateNow(),
+                         QuicTime::Delta::Zero());
+  }
+}
+
+bool tQuicServerSession::OnStreamsBlockedFrame(
+    const QuicStreamsBlockedFrame& frame)
+{
+  if (!QuicServerSessionBase::OnStreamsBlockedFrame(frame)) {
+    return false;
+  }
+  if (!frame.unidirectional) {
+    dispatcher_->OnRequestStreamsBlocked();
+  }
+  return true;
+}
+
+void tQuicServerSession::OnCongestionWindowChange(QuicTime now)
+{
+  QuicServerSessionBase::OnCongestionWindowChange(now);
+  MaybeApplyDeliveryRate();
+
+  if (connected_writer_ != nullptr || !dispatcher_->connected_udp_enabled()) {
+    return;
+  }
+
+  // Called on every ack, the rate is sampled over one second windows.
+  const QuicTime::Delta kRateSampleInterval = QuicTime::Delta::FromSeconds(1);
+  QuicByteCount bytes_sent = connection()->GetStats().bytes_sent;
+  if (rate_sample_time_.IsInitialized() &&
+      now - rate_sample_time_ < kRateSampleInterval) {
+    return;
+  }
+
+  if (rate_sample_time_.IsInitialized()) {
+    QuicBandwidth rate = QuicBandwidth::FromBytesAndTimeDelta(
+      bytes_sent - rate_sample_bytes_, now - rate_sample_time_);
+    if (rate >= dispatcher_->connected_udp_threshold()) {
+      PromoteToConnectedUdp();
+      return;
+    }
+  }
+  rate_sample_time_ = now;
+  rate_sample_bytes_ = bytes_sent;
+}
+
+void tQuicServerSession::SetMaxDeliveryRate(QuicBandwidth rate,
+                                            QuicByteCount burst)
+{
+  max_delivery_rate_ = rate;
+  delivery_burst_end_ = connection()->GetStats().bytes_sent + burst;
+  delivery_rate_applied_ = false;
+
+  if (!rate.IsZero()) {
+    dispatcher_->stats()->rate_limited_connections++;
+  }
+  MaybeApplyDeliveryRate();
+}
+
+void tQuicServerSession::MaybeApplyDeliveryRate()
+{
+  if (!delivery_rate_applied_ && !max_delivery_rate_.IsZero() &&
+      connection()->GetStats().bytes_sent >= delivery_burst_end_) {
+    delivery_rate_applied_ = true;
+  }
+
+  QuicBandwidth cap = delivery_rate_applied_ ? max_delivery_rate_ : QuicBandwidth::Zero();
+  QuicBandwidth share = tenant_ ? tenant_->RateShare() : QuicBandwidth::Zero();
+  if (!share.IsZero() && (cap.IsZero() || share < cap)) {
+    cap = share;
+  }
+  if (cap == pacing_cap_) {
+    return;
+  }
+
+  // Enforced by the sender pacing, the congestion controller can still
+  // go slower but never faster.
+  connection()->SetMaxPacingRate(cap);
+  pacing_cap_ = cap;
+}
+
+void tQuicServerSession::OnConnectionClosed(
+    const QuicConnectionCloseFrame& frame,
+    ConnectionCloseSource source)
+{
+  dispatcher_->tenants()->Detach(this);
+  QuicServerSessionBase::OnConnectionClosed(frame, source);
+  DemoteFromConnectedUdp();
+  dispatcher_->OnRequestStreamsClosed(open_request_streams_);
+  open_request_streams_ = 0;
+
+  // Requests were closed above, the connection context can go now.
+  const tQuicConnectionCallback& conn_cb = dispatcher_->connection_callback();
+  if (connection_opened_ && conn_cb.OnConnectionClose) {
+    tQuicRequestID id;
+    sockaddr_storage self_ss, peer_ss;
+    SetConnectionRequestID(&id, &self_ss, &peer_ss);
+    conn_cb.OnConnectionClose(&id, connection_ctx_, conn_cb.ConnectionContext);
+  }
+  connection_opened_ = false;
+  connection_ctx_ = nullptr;
+}
+
+void tQuicServerSession::PromoteToConnectedUdp()
+{
+  // The host has to read the new socket, without the callback it can not.
+  const tQuicSocketCallback& socket_cb = dispatcher_->socket_callback();
+  if (draining_ || !connection()->connected() ||
+      socket_cb.OnSocketOpen == nullptr) {
+    return;
+  }
+
+  // Packets of this connection still held by the shared writer go first,
+  // a deferred one only sends when asked. If the socket is blocked they
+  // would follow the connected socket's, so the promotion waits.
+  QuicPacketWriter* shared = connection()->writer();
+  WriteResult flushed = dispatcher_->deferred_flush()
+    ? static_cast<tQuicDeferredWriter*>(shared)->FlushDeferred()
+    : shared->Flush();
+  if (flushed.status == WRITE_STATUS_BLOCKED) {
+    rate_sample_time_ = QuicTime::Zero();
+    return;
+  }
+
+  connected_writer_ = tQuicConnectedWriter::Create(
+    connection()->self_address(), connection()->peer_address(),
+    dispatcher_->stats());
+  if (connected_writer_ == nullptr) {
+    dispatcher_->stats()->connected_udp_failures++;
+    TQUIC_LOG(dispatcher_->logger(), QUIC_LOG_MODULE_WRITER, QUIC_LOG_WARN,
+              "connected socket to %s failed: %s",
+              connection()->peer_address().ToString().c_str(), strerror(errno));
+    // Retry on the next sample window.
+    rate_sample_time_ = QuicTime::Zero();
+    return;
+  }
+
+  connection()->SetQuicPacketWriter(connected_writer_.get(),
+                                    /* owns_writer= */ false);
+  dispatcher_->AddConnectedWriter(connection(), connected_writer_.get());
+  dispatcher_->stats()->connected_udp_promotions++;
+
+  socket_cb.OnSocketOpen(connected_writer_->fd(), socket_cb.SocketContext);
+}
+
+void tQuicServerSession::DemoteFromConnectedUdp()
+{
+  if (connected_writer_ == nullptr) {
+    return;
+  }
+
+  QuicPacketWriter* shared = dispatcher_->GetWriter(connection()->self_address());
+  if (connected_writer_->Flush().status == WRITE_STATUS_BLOCKED) {
+    // The unsent tail, possibly the CONNECTION_CLOSE, leaves through the
+    // shared socket.
+    connected_writer_->MoveBufferedTo(shared,
+                                      connection()->self_address().host(),
+                                      connection()->peer_address());
+  }
+  connection()->SetQuicPacketWriter(shared, /* owns_writer= */ false);
+  dispatcher_->RemoveConnectedWriter(connection());
+  dispatcher_->stats()->connected_udp_demotions++;
+
+  const tQuicSocketCallback& socket_cb = dispatcher_->socket_callback();
+  if (socket_cb.OnSocketClose) {
+    socket_cb.OnSocketClose(connected_writer_->fd(), socket_cb.SocketContext);
+  }
+  connected_writer_.reset();
+  rate_sample_time_ = QuicTime::Zero();
+}
+
+bool tQuicServerSession::UpdateIdleTimeout(QuicTime::Delta idle_timeout)
+{
+  if (!connection()->connected() || !OneRttKeysAvailable()) {
+    return false;
+  }
+
+  QuicTime::Delta negotiated = config()->IdleNetworkTimeout();
+  connection()->SetNetworkTimeouts(
+    QuicTime::Delta::Infinite(),
+    negotiated.IsZero() ? idle_timeout : std::min(idle_timeout, negotiated));
+  return true;
+}
+
+void tQuicServerSession::SetMaxAge(QuicTime expire_time, QuicTime::Delta grace)
+{
+  max_age_grace_ = grace;
+  if (!draining_ && !rejected_) {
+    drain_alarm_->Set(expire_time);
+  }
+}
+
+void tQuicServerSession::StartDraining(QuicTime deadline)
+{
+  if (!connection()->connected()) {
+    return;
+  }
+
+  if (!draining_) {
+    draining_ = true;
+    drain_deadline_ = deadline;
+    dispatcher_->stats()->goaway_sent++;
+    if (VersionUsesHttp3(transport_version())) {
+      SendHttp3GoAway(QUIC_PEER_GOING_AWAY, "Server draining");
+    } else {
+      SendGoAway(QUIC_PEER_GOING_AWAY, "Server draining");
+    }
+    // Sending GOAWAY before the handshake closes the connection.
+    if (!connection()->connected()) {
+      return;
+    }
+  } else if (deadline < drain_deadline_) {
+    drain_deadline_ = deadline;
+  }
+
+  QuicTime now = connection()->clock()->ApproximateNow();
+  drain_alarm_->Update(GetNumActiveStreams() == 0 ? now : drain_deadline_,
+                       QuicTime::Delta::Zero());
+}
+
+void tQuicServerSession::OnDrainAlarm()
+{
+  if (!connection()->connected()) {
+    return;
+  }
+
+  if (rejected_) {
+    connection()->CloseConnection(
+        QUIC_CONNECTION_CANCELLED, "Rejected by host",
+        ConnectionCloseBehavior::SEND_CONNECTION_CLOSE_PACKET);
+    return;
+  }
+
+  QuicTime now = connection()->clock()->ApproximateNow();
+  if (!draining_) {
+    dispatcher_->stats()->max_age_expired++;
+    StartDraining(now + max_age_grace_);
+    return;
+  }
+
+  if (GetNumActiveStreams() == 0) {
+    dispatcher_->stats()->drained_gracefully++;
+  } else if (now >= drain_deadline_) {
+    dispatcher_->stats()->drained_by_deadline++;
+    TQUIC_LOG(dispatcher_->logger(), QUIC_LOG_MODULE_SESSION, QUIC_LOG_INFO,
+              "drain deadline closes %zu open requests",
+              GetNumActiveStreams());
+  } else {
+    drain_alarm_->Set(drain_deadline_);
+    return;
+  }
+
+  connection()->CloseConnection(
+      QUIC_PEER_GOING_AWAY, "Server drained",
+      ConnectionCloseBehavior::SEND_CONNECTION_CLOSE_PACKET);
+}
+
+void tQuicServerSession::MaybeArmProgressAlarm()
+{
+  if (progress_alarm_->IsSet() || !dispatcher_->progress_check_enabled()) {
+    return;
+  }
+
+  // Checked once per the shorter limit, a stream is reclaimed within
+  // twice its limit at the latest.
+  QuicTime::Delta interval = dispatcher_->header_timeout();
+  if (interval.IsZero() ||
+      (!dispatcher_->progress_window().IsZero() &&
+       dispatcher_->progress_window() < interval)) {
+    interval = dispatcher_->progress_window();
+  }
+  progress_alarm_->Set(connection()->clock()->ApproximateNow() + interval);
+}
+
+void tQuicServerSession::OnProgressAlarm()
+{
+  if (!connection()->connected() || !dispatcher_->progress_check_enabled()) {
+    return;
+  }
+
+  QuicTime now = connection()->clock()->ApproximateNow();
+  std::vector<std::pair<tQuicServerStream*, tQuicServerStream::StallReason>> stalled;
+  PerformActionOnActiveStreams([&](QuicStream* stream) {
+    if (!stream->is_static()) {
+      tQuicServerStream* s = static_cast<tQuicServerStream*>(stream);
+      tQuicServerStream::StallReason reason = s->CheckProgress(
+        now, dispatcher_->header_timeout(), dispatcher_->progress_window(),
+        dispatcher_->min_progress_bytes());
+      if (reason != tQuicServerStream::STREAM_PROGRESSING) {
+        stalled.emplace_back(s, reason);
+      }
+    }
+    return true;
+  });
+
+  // Reset drops the buffered data and closes the request on the host.
+  for (const auto& s : stalled) {
+    if (s.second == tQuicServerStream::STREAM_HEADER_TIMEOUT) {
+      dispatcher_->stats()->streams_reclaimed_header_timeout++;
+    } else {
+      dispatcher_->stats()->streams_reclaimed_slow_reader++;
+    }
+    TQUIC_LOG(dispatcher_->logger(), QUIC_LOG_MODULE_STREAM, QUIC_LOG_INFO,
+              "stream %u reclaimed, %s", s.first->id(),
+              s.second == tQuicServerStream::STREAM_HEADER_TIMEOUT ?
+                "header timeout" : "slow reader");
+    s.first->Reset(QUIC_STREAM_CANCELLED);
+  }
+
+  if (GetNumActiveStreams() > 0) {
+    MaybeArmProgressAlarm();
+  }
+}
+
+void tQuicServerSession::MaybeRefuseStream(QuicStream* stream)
+{
+  if (!draining_ && !rejected_) {
+    return;
+  }
+
+  // Refused requests are safe for the client to retry elsewhere.
+  dispatcher_->stats()->streams_refused++;
+  stream->Reset(QUIC_REFUSED_STREAM);
 }
 
 tQuicServerStream* tQuicServerSession::GetStream(const QuicStreamId stream_id)
@@ -70,17 +578,31 @@ QuicSpdyStream* tQuicServerSession::CreateIncomingStream(QuicStreamId id) {
     return nullptr;
   }
 
-  QuicSpdyStream* stream = new tQuicServerStream(
+  tQuicServerStream* stream = new tQuicServerStream(
       id, this, BIDIRECTIONAL, stack_ctx_, callback_, qsi_mgr_);
+  stream->set_transport_info_headers(dispatcher_->transport_info_headers());
+  stream->set_header_names(dispatcher_->header_names());
   ActivateStream(absl::WrapUnique(stream));
+  open_request_streams_++;
+  dispatcher_->OnRequestStreamOpened();
+  MaybeRefuseStream(stream);
+  MaybeArmProgressAlarm();
   return stream;
 }
 
 QuicSpdyStream* tQuicServerSession::CreateIncomingStream(
     PendingStream* pending) {
-  QuicSpdyStream* stream = new tQuicServerStream(
+  tQuicServerStream* stream = new tQuicServerStream(
       pending, this, stack_ctx_, callback_, qsi_mgr_);
+  stream->set_transport_info_headers(dispatcher_->transport_info_headers());
+  stream->set_header_names(dispatcher_->header_names());
   ActivateStream(absl::WrapUnique(stream));
+  if (stream->type() == BIDIRECTIONAL) {
+    open_request_streams_++;
+    dispatcher_->OnRequestStreamOpened();
+    MaybeRefuseStream(stream);
+    MaybeArmProgressAlarm();
+  }
   return stream;
 }
 
@@ -13,23 +13,29 @@
 #include <utility>
 #include <vector>
 
+#include "quic/core/quic_alarm.h"
 #include "quic/core/http/quic_server_session_base.h"
 #include "quic/core/http/quic_spdy_session.h"
 #include "quic/core/quic_crypto_server_stream.h"
 #include "quic/core/quic_packets.h"
 #include "quic/platform/api/quic_containers.h"
+#include "src/tQuicConnectedWriter.hh"
+#include "src/tQuicLog.hh"
 #include "src/tQuicServerStream.hh"
+#include "src/tQuicTenant.hh"
 #include "src/quic_stack_api.h"
 
 namespace nginx {
 
+class tQuicDispatcher;
+
 class tQuicServerSession : public quic::QuicServerSessionBase {
  public:
   // Takes ownership of |connection|.
   tQuicServerSession(const quic::QuicConfig& config,
                      const quic::ParsedQuicVersionVector& supported_versions,
                      quic::QuicConnection* connection,
-                     quic::QuicSession::Visitor* visitor,
+                     tQuicDispatcher* dispatcher,
                      quic::QuicCryptoServerStream::Helper* helper,
                      const quic::QuicCryptoServerConfig* crypto_config,
                      quic::QuicCompressedCertsCache* compressed_certs_cache,
@@ -48,6 +54,60 @@ class tQuicServerSession : public quic::QuicServerSessionBase {
   //only for IQUIC
   void OnTlsHandshakeComplete() override;
 
+  // Server side migration is limited to the advertised preferred address.
+  bool AllowSelfAddressChange() const override;
+
+  // Peer migrated or was NAT rebound, refreshes the open requests.
+  void OnConnectionMigration(quic::AddressChangeType type) override;
+
+  void OnStreamClosed(quic::QuicStreamId stream_id) override;
+
+  // Feeds the peer running short of request streams into limit tuning.
+  bool OnStreamsBlockedFrame(const quic::QuicStreamsBlockedFrame& frame) override;
+
+  // Samples the send rate for the connected UDP fast path.
+  void OnCongestionWindowChange(quic::QuicTime now) override;
+
+  void OnConnectionClosed(const quic::QuicConnectionCloseFrame& frame,
+                          quic::ConnectionCloseSource source) override;
+
+  // Connection lifecycle callbacks, OnConnectionOpen() is called by the
+  // dispatcher once the session is initialized.
+  void OnConnectionOpen();
+  void* connection_ctx() const { return connection_ctx_; }
+
+  // Stack logger, shared with the streams.
+  tQuicLogger* logger() const;
+
+  // Starts draining once |expire_time| is reached, with |grace| to finish
+  // the open requests.
+  void SetMaxAge(quic::QuicTime expire_time, quic::QuicTime::Delta grace);
+
+  // Sends GOAWAY, refuses new streams and closes the connection once the
+  // open requests are done, or at |deadline| at the latest.
+  void StartDraining(quic::QuicTime deadline);
+
+  bool draining() const { return draining_; }
+
+  // Applies |idle_timeout| to an established connection, capped to the
+  // negotiated one which the client may rely on. Returns false if the
+  // handshake is not done yet.
+  bool UpdateIdleTimeout(quic::QuicTime::Delta idle_timeout);
+
+  // Caps the connection pacing rate to |rate| once |burst| more bytes are
+  // sent, a zero rate removes the cap.
+  void SetMaxDeliveryRate(quic::QuicBandwidth rate, quic::QuicByteCount burst);
+
+  // Tenant of the connection, set by the dispatcher scheduler.
+  void set_tenant(tQuicTenant* tenant) { tenant_ = tenant; }
+
+  // Sends through its own connected socket.
+  bool connected_udp() const { return connected_writer_ != nullptr; }
+
+  // Moves the connection back to the shared socket, also called by the
+  // dispatcher before it goes away.
+  void DemoteFromConnectedUdp();
+
  protected:
   // QuicSession methods:
   quic::QuicSpdyStream* CreateIncomingStream(quic::QuicStreamId id) override;
@@ -62,9 +122,65 @@ class tQuicServerSession : public quic::QuicServerSessionBase {
       quic::QuicCompressedCertsCache* compressed_certs_cache) override;
 
 private:
+  class DrainAlarmDelegate;
+  class ProgressAlarmDelegate;
+
+  // Fires at max age, at the drain deadline, right after the last request
+  // of a draining session closed, or right after the host rejected it.
+  void OnDrainAlarm();
+
+  // Resets the streams that stopped making progress, see
+  // tQuicServerStream::CheckProgress().
+  void OnProgressAlarm();
+  void MaybeArmProgressAlarm();
+
+  // Refuses |stream| if it arrived after GOAWAY.
+  void MaybeRefuseStream(quic::QuicStream* stream);
+
+  // Handshake confirmed, reported once for either handshake protocol.
+  void OnHandshakeDone();
+
+  // Connection level tQuicRequestID, stream_id 0.
+  void SetConnectionRequestID(tQuicRequestID* id,
+                              sockaddr_storage* self_ss,
+                              sockaddr_storage* peer_ss);
+
+  // Applies max_delivery_rate_ once the burst allowance is used, and the
+  // tenant share of its cap, whichever is lower.
+  void MaybeApplyDeliveryRate();
+
+  // Moves the connection to its own connected socket.
+  void PromoteToConnectedUdp();
+
+  tQuicDispatcher*             dispatcher_;
   tQuicStackContext            stack_ctx_;
   tQuicRequestCallback         callback_;
   tQuicServerIdentifyManager*  qsi_mgr_;
+
+  std::unique_ptr<quic::QuicAlarm> drain_alarm_;
+  bool                         draining_;
+  quic::QuicTime               drain_deadline_;
+  quic::QuicTime::Delta        max_age_grace_;
+
+  std::unique_ptr<quic::QuicAlarm> progress_alarm_;
+
+  std::unique_ptr<tQuicConnectedWriter> connected_writer_;
+  quic::QuicTime               rate_sample_time_;
+  quic::QuicByteCount          rate_sample_bytes_;
+
+  quic::QuicBandwidth          max_delivery_rate_;
+  quic::QuicByteCount          delivery_burst_end_;
+  bool                         delivery_rate_applied_;
+
+  tQuicTenant*                 tenant_; // not owned
+  quic::QuicBandwidth          pacing_cap_;
+
+  uint64_t                     open_request_streams_;
+
+  void*                        connection_ctx_;
+  bool                         connection_opened_;
+  bool                         handshake_notified_;
+  bool                         rejected_;
 };
 
 }  // namespace nginx
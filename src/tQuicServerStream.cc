@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdio>
 #include <list>
 #include <utility>
 
@@ -12,8 +14,9 @@
 #include "googleurl/base/strings/pattern.h"
 #include "googleurl/base/strings/string_split.h"
 #include "googleurl/base/strings/string_util.h"
-#include "http_parser/http_request_headers.hh"
 #include "http_parser/http_response_headers.hh"
+#include "src/tQuicHeaderUtil.hh"
+#include "src/tQuicServerSession.hh"
 #include "src/tQuicServerStream.hh"
 
 using namespace bvc;
@@ -22,6 +25,22 @@ using spdy::SpdyHeaderBlock;
 
 namespace nginx {
 
+namespace {
+  // Smallest body chunk released by the delivery rate limit.
+  const QuicByteCount kPacingQuantum = 16 * 1024;
+}
+
+class tQuicServerStream::PacingAlarmDelegate : public QuicAlarm::Delegate {
+ public:
+  explicit PacingAlarmDelegate(tQuicServerStream* stream)
+      : stream_(stream) {}
+
+  void OnAlarm() override { stream_->ReleasePacedBody(); }
+
+ private:
+  tQuicServerStream* stream_;
+};
+
 tQuicServerIdentify::tQuicServerIdentify() {}
 tQuicServerIdentify::tQuicServerIdentify(const tQuicServerIdentify& qsi) {
    name = qsi.name;
@@ -55,20 +74,6 @@ bool tQuicServerIdentifyManager::AddServerIdentify(const tQuicServerIdentify& qs
 }
 
 
-const std::set<std::string> tQuicServerStream::kHopHeaders = {
-    "alt-svc",
-    "connection",
-    "proxy-connection",  // non-standard but still sent by libcurl and rejected
-                         // by e.g. google
-    "keep-alive", "proxy-authenticate", "proxy-authorization",
-    "te",       // canonicalized version of "TE"
-    "trailer",  // not Trailers per URL above;
-                // http://www.rfc-editor.org/errata_search.php?eid=4522
-    "transfer-encoding", "upgrade",
-    "vary",
-};
-
-
 QueuedWriteIOBuffer::QueuedWriteIOBuffer()
     : total_size_(0),
       max_buffer_size_(kDefaultMaxBufferSize) {
@@ -140,11 +145,27 @@ tQuicServerStream::tQuicServerStream(
     : QuicSpdyServerStreamBase(id, session, type),
       content_length_(-1),
       header_sent_(false),
+      request_rejected_(false),
       callback_ctx_(stack_ctx), // first time, callback ctx is stack context
       callback_(cb),
       qsi_mgr_(qsi_ptr),
+      qsi_(nullptr),
       is_new_ok_(true),
-      body_(new QueuedWriteIOBuffer()){
+      transport_info_headers_(false),
+      header_names_(&tQuicHeaderNameTable::Default()),
+      head_request_(false),
+      upstream_headers_done_(false),
+      response_streaming_(false),
+      body_(new QueuedWriteIOBuffer()),
+      max_delivery_rate_(QuicBandwidth::Zero()),
+      delivery_burst_(0),
+      delivery_start_(QuicTime::Zero()),
+      delivery_released_(0),
+      stats_(nullptr),
+      paced_offset_(0),
+      created_time_(session->connection()->clock()->ApproximateNow()),
+      progress_time_(created_time_),
+      progress_bytes_(0) {
   can_write_cb_.OnCanWriteCallback = nullptr;
   can_write_cb_.OnCanWriteContext  = nullptr;
   SetRequestID();
@@ -159,17 +180,36 @@ tQuicServerStream::tQuicServerStream(
     : QuicSpdyServerStreamBase(pending, session),
       content_length_(-1),
       header_sent_(false),
+      request_rejected_(false),
       callback_ctx_(stack_ctx),
       callback_(cb),
       qsi_mgr_(qsi_ptr),
+      qsi_(nullptr),
       is_new_ok_(true),
-      body_(new QueuedWriteIOBuffer()){
+      transport_info_headers_(false),
+      header_names_(&tQuicHeaderNameTable::Default()),
+      head_request_(false),
+      upstream_headers_done_(false),
+      response_streaming_(false),
+      body_(new QueuedWriteIOBuffer()),
+      max_delivery_rate_(QuicBandwidth::Zero()),
+      delivery_burst_(0),
+      delivery_start_(QuicTime::Zero()),
+      delivery_released_(0),
+      stats_(nullptr),
+      paced_offset_(0),
+      created_time_(session->connection()->clock()->ApproximateNow()),
+      progress_time_(created_time_),
+      progress_bytes_(0) {
   can_write_cb_.OnCanWriteCallback = nullptr;
   can_write_cb_.OnCanWriteContext  = nullptr;
   SetRequestID();
 }
 
 tQuicServerStream::~tQuicServerStream() {
+  if (pacing_alarm_ != nullptr) {
+    pacing_alarm_->Cancel();
+  }
 }
 
 void tQuicServerStream::OnRequestHeader()
@@ -217,7 +257,12 @@ void tQuicServerStream::OnInitialHeadersComplete(
     const QuicHeaderList& header_list) {
   QuicSpdyStream::OnInitialHeadersComplete(fin, frame_len, header_list);
   if (!CopyAndValidateHeaders(header_list, content_length_, raw_header_str_)) {
-    SendErrorResponse(0);
+    // Malformed request, never passed to the host. Reset before anything
+    // unblocks the sequencer, OnBodyAvailable() ignores what is left.
+    request_rejected_ = true;
+    Reset(QUIC_BAD_APPLICATION_PAYLOAD);
+    ConsumeHeaderList();
+    return;
   }
 
   if (fin) {
@@ -238,6 +283,9 @@ void tQuicServerStream::OnTrailingHeadersComplete(
 }
 
 void tQuicServerStream::OnBodyAvailable() {
+  if (request_rejected_) {
+    return;
+  }
 
   while (HasBytesToRead()) {
     struct iovec iov;
@@ -275,10 +323,14 @@ void tQuicServerStream::OnBodyAvailable() {
 
   if (content_length_ < 0) {
     content_length_ = body_->total_size();
-    HttpRequestHeaders kContentLength;
-    kContentLength.SetHeader("content-length", std::to_string(content_length_));
-    raw_header_str_ = raw_header_str_.substr(0, raw_header_str_.length()-2);
-    raw_header_str_ += kContentLength.ToString();
+    // Headers that came with fin were passed on and cleared already.
+    if (!header_sent_ && raw_header_str_.size() >= 2) {
+      raw_header_str_.resize(raw_header_str_.size() - 2);
+      AppendHeaderLine(raw_header_str_,
+                       header_names_->Name(HEADER_ID_CONTENT_LENGTH),
+                       std::to_string(content_length_));
+      raw_header_str_ += "\r\n";
+    }
   }
 
   if (!header_sent_) {
@@ -294,6 +346,11 @@ void tQuicServerStream::OnClose()
     callback_.OnRequestClose(&request_id_, callback_ctx_, &qsi_->ctx);
   }
   is_new_ok_ = false;
+
+  if (pacing_alarm_ != nullptr) {
+    pacing_alarm_->Cancel();
+  }
+  paced_body_.clear();
 }
 
 void tQuicServerStream::OnCanWriteNewData()
@@ -306,6 +363,73 @@ void tQuicServerStream::OnCanWriteNewData()
   }
 }
 
+void tQuicServerStream::OnPeerAddressChanged()
+{
+  SetRequestAddress();
+
+  if (is_new_ok_ && qsi_ && callback_.OnRequestAddressChange) {
+    callback_.OnRequestAddressChange(&request_id_, callback_ctx_, &qsi_->ctx);
+  }
+}
+
+void tQuicServerStream::SetMaxDeliveryRate(
+  QuicBandwidth rate, QuicByteCount burst, tQuicStackStats* stats)
+{
+  max_delivery_rate_ = rate;
+  delivery_burst_ = burst;
+  delivery_start_ = spdy_session()->connection()->clock()->ApproximateNow();
+  delivery_released_ = 0;
+  stats_ = stats;
+
+  if (pacing_alarm_ == nullptr && !rate.IsZero()) {
+    pacing_alarm_.reset(spdy_session()->connection()->alarm_factory()->CreateAlarm(
+      new PacingAlarmDelegate(this)));
+  }
+
+  // Lifting or changing the limit applies to a body already held back.
+  if (!paced_body_.empty()) {
+    ReleasePacedBody();
+  }
+}
+
+void tQuicServerStream::ReleasePacedBody()
+{
+  if (paced_offset_ >= paced_body_.size() || write_side_closed()) {
+    return;
+  }
+
+  QuicTime now = spdy_session()->connection()->clock()->ApproximateNow();
+  size_t remaining = paced_body_.size() - paced_offset_;
+  size_t to_release = remaining;
+  if (!max_delivery_rate_.IsZero()) {
+    QuicByteCount allowance =
+      delivery_burst_ + max_delivery_rate_.ToBytesPerPeriod(now - delivery_start_);
+    allowance = allowance > delivery_released_ ? allowance - delivery_released_ : 0;
+    to_release = std::min<size_t>(allowance, remaining);
+  }
+
+  if (to_release > 0) {
+    bool last = to_release == remaining;
+    WriteOrBufferBody(
+      quiche::QuicheStringPiece(paced_body_.data() + paced_offset_, to_release),
+      last && response_trailers_.empty());
+    paced_offset_ += to_release;
+    delivery_released_ += to_release;
+    if (last) {
+      if (!response_trailers_.empty()) {
+        WriteTrailers(std::move(response_trailers_), nullptr);
+      }
+      paced_body_.clear();
+      paced_offset_ = 0;
+      return;
+    }
+  }
+
+  QuicByteCount quantum = std::min<QuicByteCount>(kPacingQuantum, remaining - to_release);
+  pacing_alarm_->Update(now + max_delivery_rate_.TransferTime(quantum),
+                        QuicTime::Delta::FromMilliseconds(1));
+}
+
 void tQuicServerStream::AddOnCanWriteCallback(tQuicOnCanWriteCallback cb)
 {
   can_write_cb_ = cb;
@@ -365,13 +489,68 @@ void tQuicServerStream::SetTrailers(
   }
 }
 
+void tQuicServerStream::StreamResponseBody()
+{
+  if (!response_streaming_) {
+    if (response_headers_.find(":status") == response_headers_.end()) {
+      return;
+    }
+    WriteHeaders(std::move(response_headers_), false, nullptr);
+    response_streaming_ = true;
+  }
+
+  if (!response_body_.empty()) {
+    WriteOrBufferBody(response_body_, false);
+    response_body_.clear();
+  }
+}
+
 void tQuicServerStream::FlushResponse()
 {
-  response_headers_["content-length"] = std::to_string(response_body_.size());
+  if (response_streaming_) {
+    if (!response_body_.empty() || response_trailers_.empty()) {
+      WriteOrBufferBody(response_body_, response_trailers_.empty());
+      response_body_.clear();
+    }
+    if (!response_trailers_.empty()) {
+      WriteTrailers(std::move(response_trailers_), nullptr);
+    }
+    return;
+  }
+
+  // HEAD responses and those that never have a body keep the length given
+  // by the host or upstream, if any.
+  bool bodiless = head_request_;
+  auto status = response_headers_.find(":status");
+  uint64_t code = 0;
+  if (status != response_headers_.end() &&
+      quiche::QuicheTextUtilsImpl::StringToUint64(std::string(status->second), &code)) {
+    bodiless = bodiless || (code >= 100 && code < 200) || code == 204 || code == 304;
+  }
+  if (!bodiless) {
+    response_headers_["content-length"] = std::to_string(response_body_.size());
+  }
+
+  // Rate limited responses are released by ReleasePacedBody().
+  if (!max_delivery_rate_.IsZero() && !response_body_.empty()) {
+    WriteHeaders(std::move(response_headers_), false, nullptr);
+    paced_body_ = std::move(response_body_);
+    paced_offset_ = 0;
+    // The bucket fills from the first byte sent, not from the time the
+    // rate was set while the response was still being assembled.
+    delivery_start_ = spdy_session()->connection()->clock()->ApproximateNow();
+    delivery_released_ = 0;
+    ReleasePacedBody();
+    if (stats_ != nullptr) {
+      stats_->rate_limit_bytes_deferred += paced_body_.size() - paced_offset_;
+    }
+    return;
+  }
+
   SendHeadersAndBodyAndTrailers(
     std::move(response_headers_),
     response_body_,
-    SpdyHeaderBlock());
+    std::move(response_trailers_));
 }
 
 bool tQuicServerStream::WriteResponseHeader(
@@ -391,11 +570,15 @@ bool tQuicServerStream::WriteResponseHeader(
   size_t itr = 0;
   std::string name, value;
   while(resp_header->EnumerateHeaderLines(&itr, &name, &value)) {
-    const auto name_lower = gurl_base::ToLowerASCII(name);
-    if (QuicContainsKey(kHopHeaders, name_lower)) {
+    int id = header_names_->Lookup(name.data(), name.size());
+    if (tQuicHeaderNameTable::IsHopHeader(id)) {
       continue;
     }
-    response_headers_.AppendValueOrAddHeader(name_lower, value);
+    if (id != HEADER_ID_UNKNOWN) {
+      response_headers_.AppendValueOrAddHeader(header_names_->Name(id), value);
+    } else {
+      response_headers_.AppendValueOrAddHeader(gurl_base::ToLowerASCII(name), value);
+    }
   }
 
   SetTrailers(std::string(trailers, trailers_len), response_trailers_);
@@ -410,9 +593,12 @@ bool tQuicServerStream::WriteResponseHeader(
 int tQuicServerStream::WriteResponseBody(
   const char* data, size_t len, const char* trailers, size_t trailers_len, size_t limit, bool fin)
 {
+  // Rate limited bodies are held until fin, the limit only applies to what
+  // is queued to send then.
+  bool paced = !max_delivery_rate_.IsZero();
   size_t to_write_size = len;
   if (limit > 0) {
-    size_t buffered_size = BufferedDataBytes();
+    size_t buffered_size = BufferedDataBytes() + (paced ? 0 : response_body_.size());
     to_write_size = buffered_size >= limit ? 0 : limit - buffered_size;
     if (to_write_size > len) {
       to_write_size = len;
@@ -426,13 +612,112 @@ int tQuicServerStream::WriteResponseBody(
 
   SetTrailers(std::string(trailers, trailers_len), response_trailers_);
 
-  if (fin) {
+  // The host calls again for the rest, fin included.
+  if (fin && body_str.size() == len) {
     FlushResponse();
+  } else if (limit > 0 && !paced) {
+    StreamResponseBody();
   }
 
   return body_str.size();
 }
 
+int tQuicServerStream::WriteUpstreamResponse(
+  const char* data, size_t len, bool eof, bool* complete)
+{
+  *complete = false;
+  if (upstream_headers_done_ && upstream_parser_ == nullptr) {
+    return 0; // already sent
+  }
+  if (upstream_parser_ == nullptr) {
+    upstream_parser_.reset(new tQuicUpstreamParser(&response_body_, head_request_));
+  }
+
+  int consumed = upstream_parser_->Parse(data, len, eof);
+  if (consumed < 0) {
+    return QUIC_STACK_SERVER;
+  }
+
+  if (!upstream_headers_done_ && upstream_parser_->headers_complete()) {
+    response_headers_[":status"] = std::to_string(upstream_parser_->status_code());
+    for (const auto& h : upstream_parser_->headers()) {
+      int id = header_names_->Lookup(h.first.data(), h.first.size());
+      if (tQuicHeaderNameTable::IsHopHeader(id)) {
+        continue;
+      }
+      if (id != HEADER_ID_UNKNOWN) {
+        response_headers_.AppendValueOrAddHeader(header_names_->Name(id), h.second);
+      } else {
+        response_headers_.AppendValueOrAddHeader(gurl_base::ToLowerASCII(h.first), h.second);
+      }
+    }
+    upstream_headers_done_ = true;
+  }
+
+  if (upstream_parser_->message_complete()) {
+    for (const auto& t : upstream_parser_->trailers()) {
+      int id = header_names_->Lookup(t.first.data(), t.first.size());
+      if (tQuicHeaderNameTable::IsHopHeader(id)) {
+        continue;
+      }
+      if (id != HEADER_ID_UNKNOWN) {
+        response_trailers_[header_names_->Name(id)] = t.second;
+      } else {
+        response_trailers_[gurl_base::ToLowerASCII(t.first)] = t.second;
+      }
+    }
+    upstream_parser_.reset();
+    *complete = true;
+    FlushResponse();
+  }
+
+  return consumed;
+}
+
+QuicByteCount tQuicServerStream::RecommendedBufferSize(
+  QuicByteCount min_bytes, QuicByteCount max_bytes) const
+{
+  const QuicSentPacketManager& manager =
+    spdy_session()->connection()->sent_packet_manager();
+  QuicBandwidth bandwidth = manager.BandwidthEstimate();
+  QuicTime::Delta srtt = manager.GetRttStats()->smoothed_rtt();
+
+  QuicByteCount bdp = bandwidth.IsZero() || srtt.IsZero()
+                        ? manager.GetCongestionWindowInBytes()
+                        : bandwidth.ToBytesPerPeriod(srtt);
+  return std::max(min_bytes, std::min(max_bytes, 2 * bdp));
+}
+
+tQuicServerStream::StallReason tQuicServerStream::CheckProgress(
+  QuicTime now,
+  QuicTime::Delta header_timeout,
+  QuicTime::Delta window,
+  QuicByteCount min_bytes)
+{
+  if (!header_timeout.IsZero() && !headers_decompressed() &&
+      now - created_time_ >= header_timeout) {
+    return STREAM_HEADER_TIMEOUT;
+  }
+
+  // The window starts over whenever nothing is waiting to be sent.
+  QuicStreamOffset written = stream_bytes_written();
+  if (window.IsZero() || BufferedDataBytes() == 0 || !max_delivery_rate_.IsZero()) {
+    progress_time_ = now;
+    progress_bytes_ = written;
+    return STREAM_PROGRESSING;
+  }
+
+  if (now - progress_time_ < window) {
+    return STREAM_PROGRESSING;
+  }
+  if (written - progress_bytes_ < min_bytes) {
+    return STREAM_SLOW_READER;
+  }
+  progress_time_ = now;
+  progress_bytes_ = written;
+  return STREAM_PROGRESSING;
+}
+
 void tQuicServerStream::SendErrorResponse(int resp_code) {
   SendErrorResponseInternal(resp_code, kErrorResponseBody);
 }
@@ -508,7 +793,14 @@ void tQuicServerStream::SetRequestID()
   memcpy(request_id_.connection_data, cid.data(), cid.length());
   request_id_.connection_len = cid.length();
   request_id_.stream_id     = id();
+  request_id_.connection_ctx =
+    static_cast<tQuicServerSession*>(spdy_session())->connection_ctx();
+
+  SetRequestAddress();
+}
 
+void tQuicServerStream::SetRequestAddress()
+{
   self_generic_address_ = spdy_session()->self_address().generic_address();
   peer_generic_address_ = spdy_session()->peer_address().Normalized().generic_address();
 
@@ -532,71 +824,191 @@ bool tQuicServerStream::CopyAndValidateHeaders(
 {
   header_str.clear();
 
+  // Request fields in arrival order, a repeated name replaces the value.
+  // Interned names are found through |known|, the others are compared.
+  struct Field {
+    int                id;
+    const std::string* name;
+    const std::string* value;
+  };
+  std::vector<Field> fields;
+  fields.reserve(header_list.size() + 1);
+  int16_t known[tQuicHeaderNameTable::kMaxNames];
+  std::fill_n(known, header_names_->size(), -1);
+  std::list<std::string> lowered; // unknown names sent with upper case
+
+  auto set_field = [&](int id, const std::string* name, const std::string* value) {
+    if (id != HEADER_ID_UNKNOWN) {
+      if (known[id] >= 0) {
+        fields[known[id]].value = value;
+        return;
+      }
+      known[id] = static_cast<int16_t>(fields.size());
+    } else {
+      for (auto& field : fields) {
+        if (field.id == HEADER_ID_UNKNOWN && *field.name == *name) {
+          field.value = value;
+          return;
+        }
+      }
+    }
+    fields.push_back({id, name, value});
+  };
+
   // first of all, fetch request line
-  std::string method;
-  std::string path;
+  const std::string* method = nullptr;
+  const std::string* path = nullptr;
   std::string cookies;
-  HttpRequestHeaders headers;
   for (const auto& p : header_list) {
-    std::string name = p.first;
-    if (name.empty()) {
-      //QUIC_DLOG(ERROR) << "Header name must not be empty.";
+    tQuicHeaderNameStatus status = ValidateHeaderName(p.first.data(), p.first.size());
+    if (status == HEADER_NAME_INVALID ||
+        !ValidateHeaderValue(p.second.data(), p.second.size())) {
+      TQUIC_LOG(static_cast<tQuicServerSession*>(spdy_session())->logger(),
+                QUIC_LOG_MODULE_STREAM, QUIC_LOG_DEBUG,
+                "malformed header: %s", p.first.c_str());
       return false;
     }
 
-    if (std::find_if(name.begin(), name.end(), ::isupper) != name.end()) {
-      //QUIC_DLOG(ERROR) << "Malformed header: Header name " << name
-      //                 << " contains upper-case characters.";
-      name = gurl_base::ToLowerASCII(name);
+    int id = header_names_->Lookup(p.first.data(), p.first.size());
+    switch (id) {
+      case HEADER_ID_CONTENT_LENGTH: {
+        uint64_t val;
+        if (!quiche::QuicheTextUtilsImpl::StringToUint64(p.second, &val)) {
+          return false;
+        }
+        if (content_length < 0) {
+          content_length = val;
+        }
+        continue;
+      }
+      case HEADER_ID_COOKIE:
+        if (!p.second.empty()) {
+          cookies += p.second;
+          cookies += ";";
+          continue;
+        }
+        break;
+      case HEADER_ID_METHOD:
+        method = &p.second;
+        head_request_ = p.second == "HEAD";
+        continue;
+      case HEADER_ID_PATH:
+        path = &p.second;
+        continue;
+      case HEADER_ID_AUTHORITY:
+        set_field(HEADER_ID_HOST, &header_names_->Name(HEADER_ID_HOST), &p.second);
+        request_host_ = p.second;
+        continue;
+      case HEADER_ID_TRANSPORT_PROTOCOL:
+        // Set by the stack below.
+        continue;
+      default:
+        break;
     }
 
-    if (name == "content-length") {
-      uint64_t val;
-      if (!quiche::QuicheTextUtilsImpl::StringToUint64(p.second, &val)) {
-        return false;
-      }
-      if (content_length < 0) {
-        content_length = val;
-      }
-      continue;
+    const std::string* name = &p.first;
+    if (id != HEADER_ID_UNKNOWN) {
+      name = &header_names_->Name(id);
+    } else if (status == HEADER_NAME_UPPERCASE) {
+      TQUIC_LOG(static_cast<tQuicServerSession*>(spdy_session())->logger(),
+                QUIC_LOG_MODULE_STREAM, QUIC_LOG_DEBUG,
+                "header name %s contains upper-case characters", p.first.c_str());
+      lowered.push_back(p.first);
+      LowercaseASCII(&lowered.back()[0], lowered.back().size());
+      name = &lowered.back();
     }
 
-    if (name == "cookie" && !p.second.empty()) {
-      cookies += p.second;
-      cookies += ";";
+    // Other pseudo headers are not passed on.
+    if ((*name)[0] == ':') {
       continue;
     }
 
-    if (name[0] == ':') {
-      if (name[1] == 'm') { // method
-        method = p.second;
-      } else if (name[1] == 'p') { // path
-        path = p.second;
-      } else if (name[1] == 'a') { // authority
-        headers.SetHeader("Host", p.second);
-        request_host_ = p.second;
-      }
+    // Clients must not be able to forge the stack estimates.
+    if (transport_info_headers_ && name->compare(0, 7, "x-quic-") == 0) {
       continue;
     }
 
-    headers.SetHeader(name, p.second);
+    set_field(id, name, &p.second);
   }
 
   if (!cookies.empty()) {
-    headers.SetHeader("cookie", cookies);
+    set_field(HEADER_ID_COOKIE, &header_names_->Name(HEADER_ID_COOKIE), &cookies);
   }
 
+  std::string content_length_str;
   if (content_length >= 0) {
-    headers.SetHeader("content-length", std::to_string(content_length));
+    content_length_str = std::to_string(content_length);
+    set_field(HEADER_ID_CONTENT_LENGTH,
+              &header_names_->Name(HEADER_ID_CONTENT_LENGTH),
+              &content_length_str);
   }
-  headers.SetHeader("transport-protocol", std::string("quic"));
-  header_str = method + std::string(" ") +
-               path   + std::string(" HTTP/1.1\r\n") +
-               headers.ToString();
+
+  static const std::string kEmpty;
+  const std::string& method_str = method ? *method : kEmpty;
+  const std::string& path_str = path ? *path : kEmpty;
+  size_t size = method_str.size() + path_str.size() + 64;
+  for (const auto& field : fields) {
+    size += field.name->size() + field.value->size() + 4;
+  }
+  header_str.reserve(size);
+
+  header_str.append(method_str);
+  header_str.append(" ");
+  header_str.append(path_str);
+  header_str.append(" HTTP/1.1\r\n");
+  for (const auto& field : fields) {
+    AppendHeaderLine(header_str, *field.name, *field.value);
+  }
+  AppendHeaderLine(header_str, header_names_->Name(HEADER_ID_TRANSPORT_PROTOCOL), "quic");
+  if (transport_info_headers_) {
+    SetTransportInfoHeaders(header_str);
+  }
+  header_str.append("\r\n");
 
   return true;
 }
 
+void tQuicServerStream::AppendHeaderLine(std::string& header_str,
+                                         quiche::QuicheStringPiece name,
+                                         quiche::QuicheStringPiece value)
+{
+  header_str.append(name.data(), name.size());
+  header_str.append(": ");
+  header_str.append(value.data(), value.size());
+  header_str.append("\r\n");
+}
+
+void tQuicServerStream::SetTransportInfoHeaders(std::string& header_str)
+{
+  const QuicConnection* connection = spdy_session()->connection();
+  const QuicSentPacketManager& manager = connection->sent_packet_manager();
+  const RttStats* rtt_stats = manager.GetRttStats();
+
+  // Early requests may arrive before the first estimate, leave it out.
+  QuicBandwidth bandwidth = manager.BandwidthEstimate();
+  if (!bandwidth.IsZero()) {
+    AppendHeaderLine(header_str, "x-quic-bw",
+                     std::to_string(bandwidth.ToBitsPerSecond()));
+  }
+  if (!rtt_stats->smoothed_rtt().IsZero()) {
+    AppendHeaderLine(header_str, "x-quic-rtt",
+                     std::to_string(rtt_stats->smoothed_rtt().ToMilliseconds()));
+  }
+  if (!rtt_stats->min_rtt().IsZero()) {
+    AppendHeaderLine(header_str, "x-quic-min-rtt",
+                     std::to_string(rtt_stats->min_rtt().ToMilliseconds()));
+  }
+
+  // Loss in percent of the packets sent so far.
+  const QuicConnectionStats& stats = connection->GetStats();
+  if (stats.packets_sent > 0) {
+    char loss[16];
+    snprintf(loss, sizeof(loss), "%.2f",
+             100.0 * stats.packets_lost / stats.packets_sent);
+    AppendHeaderLine(header_str, "x-quic-loss", loss);
+  }
+}
+
 const char* const tQuicServerStream::kErrorResponseBody = "bad";
 
 const char* const tQuicServerStream::k403ResponseBody =
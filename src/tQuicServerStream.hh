@@ -13,10 +13,14 @@
 
 #include "net/base/io_buffer.h"
 #include "quic/core/http/quic_spdy_server_stream_base.h"
+#include "quic/core/quic_alarm.h"
+#include "quic/core/quic_bandwidth.h"
 #include "quic/core/quic_packets.h"
 #include "platform/quiche_platform_impl/quiche_text_utils_impl.h"
 #include "spdy/core/spdy_framer.h"
 #include "quic_stack_api.h"
+#include "src/tQuicHeaderUtil.hh"
+#include "src/tQuicUpstreamParser.hh"
 
 
 namespace nginx {
@@ -128,10 +132,57 @@ class tQuicServerStream : public quic::QuicSpdyServerStreamBase {
 
   void FlushResponse();
 
+  // Sends the headers and the body written so far ahead of fin, for
+  // bodies written with a limit, which then bounds the bytes held.
+  void StreamResponseBody();
+
   bool WriteResponseHeader(const char* data, size_t len, const char* trailers, size_t trailers_len, int fin);
 
   int WriteResponseBody(const char* data, size_t len, const char* trailers, size_t trailers_len, size_t limit, bool fin);
 
+  // Passthrough of a raw upstream HTTP/1.1 response, see
+  // quic_stack_write_upstream_response. Returns the bytes consumed or
+  // QUIC_STACK_SERVER, |complete| is set once the response is sent.
+  int WriteUpstreamResponse(const char* data, size_t len, bool eof, bool* complete);
+
+  // Buffered bytes worth keeping for this stream: 2x the connection BDP
+  // (bandwidth estimate times smoothed RTT), clamped to [min, max]. The
+  // congestion window stands in until there is an estimate.
+  quic::QuicByteCount RecommendedBufferSize(quic::QuicByteCount min_bytes,
+                                            quic::QuicByteCount max_bytes) const;
+
+  // Refreshes the peer address of request_id_ and tells the host.
+  void OnPeerAddressChanged();
+
+  // Limits the response body to |rate| once |burst| bytes are released,
+  // a zero rate removes the limit. Bytes held back are counted in |stats|.
+  void SetMaxDeliveryRate(quic::QuicBandwidth rate,
+                          quic::QuicByteCount burst,
+                          tQuicStackStats* stats);
+
+  // Why a stream is reclaimed by CheckProgress().
+  enum StallReason {
+    STREAM_PROGRESSING,
+    STREAM_HEADER_TIMEOUT,
+    STREAM_SLOW_READER,
+  };
+
+  // Request headers not complete after |header_timeout|, or a response
+  // with data waiting to be sent that delivered less than |min_bytes| over
+  // |window|. Zero deltas disable the check. Rate limited responses are
+  // slow on purpose and never reported.
+  StallReason CheckProgress(quic::QuicTime now,
+                            quic::QuicTime::Delta header_timeout,
+                            quic::QuicTime::Delta window,
+                            quic::QuicByteCount min_bytes);
+
+  // Adds x-quic-bw, x-quic-rtt, x-quic-min-rtt and x-quic-loss to the
+  // request headers passed to the host.
+  void set_transport_info_headers(bool enabled) { transport_info_headers_ = enabled; }
+
+  // Interned names used by the header paths, not owned.
+  void set_header_names(const tQuicHeaderNameTable* names) { header_names_ = names; }
+
   void OnCanWriteNewData() override; // override from quic_stream
   void AddOnCanWriteCallback(tQuicOnCanWriteCallback cb);
 
@@ -139,10 +190,10 @@ class tQuicServerStream : public quic::QuicSpdyServerStreamBase {
 
  protected:
 
-  static const std::set<std::string> kHopHeaders;
   static const std::set<std::string> kTrailersHeaders;
 
   void SetRequestID();
+  void SetRequestAddress();
 
   void CopySocketAddress(sockaddr** sa, socklen_t& len, sockaddr_storage& ss);
 
@@ -154,6 +205,17 @@ class tQuicServerStream : public quic::QuicSpdyServerStreamBase {
 
   void SetTrailers(const std::string& str, spdy::SpdyHeaderBlock& header);
 
+  // Appends the current connection estimates as x-quic-* header lines.
+  void SetTransportInfoHeaders(std::string& header_str);
+
+  static void AppendHeaderLine(std::string& header_str,
+                               quiche::QuicheStringPiece name,
+                               quiche::QuicheStringPiece value);
+
+  // Hands the part of paced_body_ allowed by the delivery rate to the
+  // send buffer and schedules the next release.
+  void ReleasePacedBody();
+
   void SendHeadersAndBody(spdy::SpdyHeaderBlock response_headers,
                           quiche::QuicheStringPiece body);
   void SendHeadersAndBodyAndTrailers(spdy::SpdyHeaderBlock response_headers,
@@ -170,6 +232,8 @@ class tQuicServerStream : public quic::QuicSpdyServerStreamBase {
   spdy::SpdyHeaderBlock request_headers_;
   int64_t               content_length_;
   bool                  header_sent_;
+  // Malformed headers, the stream was reset.
+  bool                  request_rejected_;
 
   std::string             request_host_;
   std::string             raw_header_str_;
@@ -181,15 +245,42 @@ class tQuicServerStream : public quic::QuicSpdyServerStreamBase {
   tQuicServerIdentify*    qsi_;
   bool                    is_new_ok_;
   tQuicOnCanWriteCallback can_write_cb_;
+  bool                    transport_info_headers_;
+  const tQuicHeaderNameTable* header_names_;
 
   spdy::SpdyHeaderBlock response_headers_;
   std::string           response_body_;
   spdy::SpdyHeaderBlock response_trailers_;
 
+  // Request method is HEAD, its response has no body.
+  bool                  head_request_;
+  // Parser of the passthrough response, created on first use.
+  std::unique_ptr<tQuicUpstreamParser> upstream_parser_;
+  bool                  upstream_headers_done_;
+  // Headers went out ahead of the body, see StreamResponseBody().
+  bool                  response_streaming_;
+
   sockaddr_storage self_generic_address_;
   sockaddr_storage peer_generic_address_;
  private:
+  class PacingAlarmDelegate;
+
   const quic::QuicReferenceCountedPointer<QueuedWriteIOBuffer>  body_;
+
+  // Delivery rate limit, applied after delivery_burst_ bytes.
+  quic::QuicBandwidth   max_delivery_rate_;
+  quic::QuicByteCount   delivery_burst_;
+  quic::QuicTime        delivery_start_;
+  quic::QuicByteCount   delivery_released_;
+  tQuicStackStats*      stats_; // not owned
+  std::string           paced_body_;
+  size_t                paced_offset_;
+  std::unique_ptr<quic::QuicAlarm> pacing_alarm_;
+
+  // Progress marks of CheckProgress().
+  quic::QuicTime        created_time_;
+  quic::QuicTime        progress_time_;
+  quic::QuicStreamOffset progress_bytes_;
 };
 
 }  // namespace nginx
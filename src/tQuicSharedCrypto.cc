@@ -0,0 +1,217 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "quic/core/crypto/crypto_framer.h"
+#include "quic/core/crypto/crypto_protocol.h"
+#include "quic/core/crypto/curve25519_key_exchange.h"
+#include "quic/core/crypto/p256_key_exchange.h"
+#include "src/tQuicProofSource.hh"
+#include "src/tQuicSharedCrypto.hh"
+#include "openssl/sha.h"
+
+using namespace quic;
+
+namespace nginx {
+
+namespace {
+  const uint64_t scfgExpiryTime  = 4733481600*1000000; //unix timestamp in Microseconds 
+}
+
+tQuicSharedCrypto::tQuicSharedCrypto()
+  : has_server_config_(false)
+{
+}
+
+void tQuicSharedCrypto::PrepareServerConfig(const QuicClock* clock)
+{
+  // Without a host name the SCFG is random, but still the same for every
+  // worker sharing it.
+  HostConfigOptions(&config_options_);
+  server_config_ = GenerateConfigProtobuf(QuicRandom::GetInstance(), clock,
+                                          config_options_);
+  has_server_config_ = true;
+}
+
+size_t tQuicSharedCrypto::AddCertificates(
+    const std::vector<tQuicServerIdentify>& qsis,
+    int threads,
+    std::vector<bool>* loaded)
+{
+  std::vector<std::pair<std::string, std::string>> paths;
+  paths.reserve(qsis.size());
+  for (const tQuicServerIdentify& qsi : qsis) {
+    paths.emplace_back(qsi.cert_path, qsi.key_path);
+  }
+
+  std::vector<tQuicProofSource::LoadedChain> chains;
+  tQuicProofSource::LoadCertificateChains(paths, threads, &chains);
+
+  size_t added = 0;
+  if (loaded != nullptr) {
+    loaded->assign(qsis.size(), false);
+  }
+  for (size_t i = 0; i < chains.size(); i++) {
+    if (!chains[i].ok) {
+      continue;
+    }
+    Certificate cert;
+    cert.qsi = qsis[i];
+    cert.chain = chains[i].chain;
+    cert.key = std::move(chains[i].key);
+    cert.hosts = std::move(chains[i].hosts);
+    certificates_.push_back(std::move(cert));
+    if (loaded != nullptr) {
+      (*loaded)[i] = true;
+    }
+    added++;
+  }
+  return added;
+}
+
+bool tQuicSharedCrypto::HostConfigOptions(
+    QuicCryptoServerConfig::ConfigOptions* options) {
+    char host_name[64];
+    if(gethostname(host_name, sizeof(host_name))) {
+        return false;
+    }
+    std::string host_name_str = host_name;
+    std::string host_name_prefix = host_name_str.substr(0, host_name_str.find_last_of('-') + 1);
+    if (host_name_prefix.empty()) {
+        return false;
+    }
+    uint8_t scid_bytes[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const uint8_t*>(host_name_prefix.data()),
+           host_name_prefix.size(), scid_bytes);
+
+    options->id = std::string(reinterpret_cast<const char*>(scid_bytes), 16);
+    options->orbit = std::string(reinterpret_cast<const char*>(scid_bytes), 8);
+    options->expiry_time = QuicWallTime::FromUNIXMicroseconds(scfgExpiryTime);
+    return true;
+}
+
+QuicServerConfigProtobuf tQuicSharedCrypto::GenerateConfigProtobuf(
+    QuicRandom* rand,
+    const QuicClock* clock,
+    const QuicCryptoServerConfig::ConfigOptions& options) {
+  CryptoHandshakeMessage msg;
+  std::string curve25519_private_key; 
+  if (options.id.empty()) {
+      curve25519_private_key =
+          Curve25519KeyExchange::NewPrivateKey(rand);
+  } else {
+      uint8_t private_key_bytes[32];
+      SHA256(reinterpret_cast<const uint8_t*>(options.id.data()),
+           options.id.size(), private_key_bytes);
+      curve25519_private_key = 
+          std::string(reinterpret_cast<const char*>(private_key_bytes),
+                      sizeof(private_key_bytes));
+  }
+
+  std::unique_ptr<Curve25519KeyExchange> curve25519 =
+      Curve25519KeyExchange::New(curve25519_private_key);
+  quiche::QuicheStringPiece curve25519_public_value =
+      curve25519->public_value();
+
+  std::string encoded_public_values;
+  // First three bytes encode the length of the public value.
+  QUICHE_DCHECK_LT(curve25519_public_value.size(), (1U << 24));
+  encoded_public_values.push_back(
+      static_cast<char>(curve25519_public_value.size()));
+  encoded_public_values.push_back(
+      static_cast<char>(curve25519_public_value.size() >> 8));
+  encoded_public_values.push_back(
+      static_cast<char>(curve25519_public_value.size() >> 16));
+  encoded_public_values.append(curve25519_public_value.data(),
+                               curve25519_public_value.size());
+
+  std::string p256_private_key;
+  if (options.p256) {
+    p256_private_key = P256KeyExchange::NewPrivateKey();
+    std::unique_ptr<P256KeyExchange> p256(
+        P256KeyExchange::New(p256_private_key));
+    quiche::QuicheStringPiece p256_public_value = p256->public_value();
+
+    QUICHE_DCHECK_LT(p256_public_value.size(), (1U << 24));
+    encoded_public_values.push_back(
+        static_cast<char>(p256_public_value.size()));
+    encoded_public_values.push_back(
+        static_cast<char>(p256_public_value.size() >> 8));
+    encoded_public_values.push_back(
+        static_cast<char>(p256_public_value.size() >> 16));
+    encoded_public_values.append(p256_public_value.data(),
+                                 p256_public_value.size());
+  }
+
+  msg.set_tag(kSCFG);
+  if (options.p256) {
+    msg.SetVector(kKEXS, QuicTagVector{kC255, kP256});
+  } else {
+    msg.SetVector(kKEXS, QuicTagVector{kC255});
+  }
+  msg.SetVector(kAEAD, QuicTagVector{kAESG, kCC20});
+  msg.SetStringPiece(kPUBS, encoded_public_values);
+
+  if (options.expiry_time.IsZero()) {
+    const QuicWallTime now = clock->WallNow();
+    const QuicWallTime expiry = now.Add(QuicTime::Delta::FromSeconds(
+        60 * 60 * 24 * 180 /* 180 days, ~six months */));
+    const uint64_t expiry_seconds = expiry.ToUNIXSeconds();
+    msg.SetValue(kEXPY, expiry_seconds);
+  } else {
+    msg.SetValue(kEXPY, options.expiry_time.ToUNIXSeconds());
+  }
+
+  char orbit_bytes[kOrbitSize];
+  if (options.orbit.size() == sizeof(orbit_bytes)) {
+    memcpy(orbit_bytes, options.orbit.data(), sizeof(orbit_bytes));
+  } else {
+    QUICHE_DCHECK(options.orbit.empty());
+    rand->RandBytes(orbit_bytes, sizeof(orbit_bytes));
+  }
+  msg.SetStringPiece(
+      kORBT, quiche::QuicheStringPiece(orbit_bytes, sizeof(orbit_bytes)));
+
+  if (options.channel_id_enabled) {
+    msg.SetVector(kPDMD, QuicTagVector{kCHID});
+  }
+
+  if (options.id.empty()) {
+    // We need to ensure that the SCID changes whenever the server config does
+    // thus we make it a hash of the rest of the server config.
+    std::unique_ptr<QuicData> serialized =
+        CryptoFramer::ConstructHandshakeMessage(msg);
+
+    uint8_t scid_bytes[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const uint8_t*>(serialized->data()),
+           serialized->length(), scid_bytes);
+    // The SCID is a truncated SHA-256 digest.
+    static_assert(16 <= SHA256_DIGEST_LENGTH, "SCID length too high.");
+    msg.SetStringPiece(kSCID,
+                       quiche::QuicheStringPiece(
+                           reinterpret_cast<const char*>(scid_bytes), 16));
+  } else {
+    msg.SetStringPiece(kSCID, options.id);
+  }
+  // Don't put new tags below this point. The SCID generation should hash over
+  // everything but itself and so extra tags should be added prior to the
+  // preceding if block.
+
+  std::unique_ptr<QuicData> serialized =
+      CryptoFramer::ConstructHandshakeMessage(msg);
+
+  QuicServerConfigProtobuf config;
+  config.set_config(std::string(serialized->AsStringPiece()));
+  QuicServerConfigProtobuf::PrivateKey* curve25519_key = config.add_key();
+  curve25519_key->set_tag(kC255);
+  curve25519_key->set_private_key(curve25519_private_key);
+
+  if (options.p256) {
+    QuicServerConfigProtobuf::PrivateKey* p256_key = config.add_key();
+    p256_key->set_tag(kP256);
+    p256_key->set_private_key(p256_private_key);
+  }
+
+  return config;
+}
+
+}  // namespace nginx
@@ -0,0 +1,75 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack crypto state shared by the stacks of all workers.
+
+#ifndef _NGINX_T_QUIC_SHARED_CRYPTO_H_
+#define _NGINX_T_QUIC_SHARED_CRYPTO_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "quic/core/crypto/certificate_view.h"
+#include "quic/core/crypto/proof_source.h"
+#include "quic/core/crypto/quic_crypto_server_config.h"
+#include "quic/core/crypto/quic_random.h"
+#include "quic/core/proto/crypto_server_config_proto.h"
+#include "quic/core/quic_clock.h"
+#include "src/tQuicServerStream.hh"
+
+namespace nginx {
+
+// The SCFG and the parsed certificates, prepared once by the master process
+// before it forks the workers. Nothing is written after preparation, so the
+// workers share the pages copy-on-write and their stacks start without
+// hashing, key derivation or certificate parsing of their own.
+class tQuicSharedCrypto {
+ public:
+  struct Certificate {
+    tQuicServerIdentify                                       qsi;
+    quic::QuicReferenceCountedPointer<quic::ProofSource::Chain> chain;
+    std::shared_ptr<const quic::CertificatePrivateKey>        key;
+    std::vector<std::string>                                  hosts;
+  };
+
+  tQuicSharedCrypto();
+  tQuicSharedCrypto(const tQuicSharedCrypto&) = delete;
+  tQuicSharedCrypto& operator=(const tQuicSharedCrypto&) = delete;
+
+  // Generates the SCFG, from the host name if HostConfigOptions() can.
+  void PrepareServerConfig(const quic::QuicClock* clock);
+
+  // Loads the chains and keys of |qsis| on up to |threads| threads, see
+  // tQuicProofSource::LoadCertificateChains(). |loaded|, if given, tells
+  // which ones could be used. Returns how many.
+  size_t AddCertificates(const std::vector<tQuicServerIdentify>& qsis,
+                         int threads,
+                         std::vector<bool>* loaded);
+
+  bool has_server_config() const { return has_server_config_; }
+  const quic::QuicCryptoServerConfig::ConfigOptions& config_options() const {
+    return config_options_;
+  }
+  const quic::QuicServerConfigProtobuf& server_config() const { return server_config_; }
+  const std::vector<Certificate>& certificates() const { return certificates_; }
+
+  // SCFG id and orbit from a hash of the host name up to its last '-', so
+  // every server of a cluster hands out the same SCFG.
+  static bool HostConfigOptions(quic::QuicCryptoServerConfig::ConfigOptions* options);
+
+  // Generates a QuicServerConfigProtobuf protobuf suitable for
+  // QuicServAddConfig and SetConfigs in QuicCryptoServerConfig.
+  static quic::QuicServerConfigProtobuf GenerateConfigProtobuf(
+    quic::QuicRandom* rand,
+    const quic::QuicClock* clock,
+    const quic::QuicCryptoServerConfig::ConfigOptions& options);
+
+ private:
+  quic::QuicCryptoServerConfig::ConfigOptions config_options_;
+  quic::QuicServerConfigProtobuf              server_config_;
+  bool                                        has_server_config_;
+  std::vector<Certificate>                    certificates_;
+};
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_SHARED_CRYPTO_H_
@@ -1,18 +1,20 @@
+#include <algorithm>
+#include <set>
+
+#include <time.h>
+
 #include "base/files/file_path.h"
+#include "quic/core/quic_default_clock.h"
 #include "quic/core/quic_default_packet_writer.h"
-#include "quic/core/crypto/curve25519_key_exchange.h"
-#include "quic/core/crypto/p256_key_exchange.h"
 #include "src/tQuicProofSource.hh"
 #include "src/tQuicConnectionHelper.hh"
+#include "src/tQuicCpu.hh"
 #include "src/tQuicCryptoServerStream.hh"
 #include "src/tQuicServerSession.hh"
+#include "src/tQuicSharedCrypto.hh"
 #include "quic/core/batch_writer/quic_batch_writer_buffer.h"
 #include "quic/core/batch_writer/quic_sendmmsg_batch_writer.h"
 #include "src/tQuicStack.hh"
-#include "openssl/sha.h"
-#include "spdlog/spdlog.h"
-#include "spdlog/sinks/stdout_color_sinks.h"
-#include "spdlog/sinks/basic_file_sink.h"
 
 using namespace quic;
 
@@ -20,41 +22,195 @@ namespace nginx {
 
 namespace {
   const char kSourceAddressTokenSecret[] = "bilibili";
-  const uint64_t scfgExpiryTime  = 4733481600*1000000; //unix timestamp in Microseconds 
-}
-
-
-tQuicStack::tQuicStack(
-  tQuicStackContext stack_ctx,
-  tQuicRequestCallback cb,
-  tQuicClockTimeGenerator clock_gen,
-  uint32_t max_streams_per_connection,
-  uint64_t initial_idle_timeout_in_sec,
-  uint64_t default_idle_timeout_in_sec,
-  uint64_t max_idle_timeout_in_sec,
-  uint64_t max_time_before_crypto_handshake_in_sec,
-  uint8_t expected_connection_id_length)
-  : stack_ctx_(stack_ctx),
-    callback_(cb),
-    clock_(clock_gen),
+
+  // Certificate of the API as registered with the stack, false if incomplete.
+  bool ServerIdentifyFromCertificate(const tQuicStackCertificate* cert_ptr,
+                                     tQuicServerIdentify* qsi) {
+    if (cert_ptr->certificate == nullptr || cert_ptr->certificate_len <= 0 ||
+        cert_ptr->certificate_key == nullptr || cert_ptr->certificate_key_len <= 0 ||
+        cert_ptr->hostname == nullptr || cert_ptr->hostname_len <= 0 ||
+        cert_ptr->server_ctx == nullptr) {
+      return false;
+    }
+
+    qsi->name      = std::string(cert_ptr->hostname, cert_ptr->hostname_len);
+    qsi->cert_path = std::string(cert_ptr->certificate, cert_ptr->certificate_len);
+    qsi->key_path  = std::string(cert_ptr->certificate_key, cert_ptr->certificate_key_len);
+    qsi->ctx = *cert_ptr->server_ctx;
+    return true;
+  }
+
+  // Empty quic_stack_poll calls before falling back to interrupt mode.
+  const int kMaxEmptyPolls = 4;
+
+  int64_t ThreadCpuTimeInUsec() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+      return 0;
+    }
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  // RFC versions, v1 and v2 share the "h3" ALPN.
+  bool IsRfcVersion(const ParsedQuicVersion& version) {
+    return version.UsesTls() && AlpnForVersion(version) == "h3";
+  }
+
+  // Versions of one stack, the RFC ones in front of the drafts and gQUIC so
+  // they win version negotiation and lead the Alt-Svc list.
+  ParsedQuicVersionVector StackSupportedVersions(bool disable_gquic,
+                                                 bool draft_versions) {
+    ParsedQuicVersionVector versions;
+    for (const ParsedQuicVersion& version : AllSupportedVersions()) {
+      if (version.handshake_protocol == PROTOCOL_QUIC_CRYPTO) {
+        if (disable_gquic) {
+          continue;
+        }
+      } else if (!draft_versions && !IsRfcVersion(version)) {
+        continue;
+      }
+      versions.push_back(version);
+    }
+
+    std::stable_partition(versions.begin(), versions.end(), IsRfcVersion);
+
+    // The version manager also drops versions whose quiche flag is off. The
+    // flags are process wide but only gate versions a stack lists, so
+    // turning on the ones served here leaves the other stacks as they are.
+    for (const ParsedQuicVersion& version : versions) {
+      if (version.UsesTls()) {
+        QuicEnableVersion(version);
+      }
+    }
+    return versions;
+  }
+}
+
+
+tQuicStack::tQuicStack(const tQuicStackConfig& opt)
+  : stack_ctx_(opt.stack_ctx),
+    callback_(opt.req_cb),
+    clock_(opt.clock_gen),
     config_(QuicConfig()),
     crypto_config_(kSourceAddressTokenSecret,
                    QuicRandom::GetInstance(),
                    std::make_unique<nginx::tQuicProofSource>(&clock_),
                    KeyExchangeSource::Default()),
     crypto_config_options_(QuicCryptoServerConfig::ConfigOptions()),
-    version_manager_(AllSupportedVersions()),
-    max_streams_per_connection_(max_streams_per_connection),
-    initial_idle_timeout_in_sec_(initial_idle_timeout_in_sec),
-    default_idle_timeout_in_sec_(default_idle_timeout_in_sec),
-    max_idle_timeout_in_sec_(max_idle_timeout_in_sec),
-    max_time_before_crypto_handshake_in_sec_(max_time_before_crypto_handshake_in_sec),
-    expected_connection_id_length_(expected_connection_id_length)
+    version_manager_(StackSupportedVersions(opt.disable_gquic != 0,
+                                            opt.ietf_draft_versions != 0)),
+    max_streams_per_connection_(opt.max_streams_per_connection),
+    max_unidirectional_streams_per_connection_(opt.max_unidirectional_streams_per_connection),
+    max_streams_auto_tune_(opt.max_streams_auto_tune != 0),
+    max_streams_per_connection_limit_(
+      std::max(opt.max_streams_per_connection, opt.max_streams_per_connection_limit)),
+    max_open_streams_total_(opt.max_open_streams_total),
+    initial_idle_timeout_in_sec_(opt.initial_idle_timeout_in_sec),
+    max_idle_timeout_in_sec_(opt.max_idle_timeout_in_sec),
+    max_time_before_crypto_handshake_in_sec_(opt.max_time_before_crypto_handshake_in_sec),
+    initial_stream_flow_control_window_(opt.initial_stream_flow_control_window),
+    initial_session_flow_control_window_(opt.initial_session_flow_control_window),
+    expected_connection_id_length_(kQuicDefaultConnectionIdLength),
+    disable_gquic_(opt.disable_gquic != 0),
+    max_connection_age_in_sec_(opt.max_connection_age_in_sec),
+    max_connection_age_grace_in_sec_(opt.max_connection_age_grace_in_sec),
+    connected_udp_threshold_bps_(opt.connected_udp_threshold_bps),
+    busy_poll_us_(opt.busy_poll_us),
+    empty_polls_(0),
+    deferred_flush_(opt.deferred_flush != 0),
+    adaptive_buffer_limit_(opt.adaptive_buffer_limit != 0),
+    buffer_target_min_bytes_(opt.buffer_target_min_bytes),
+    buffer_target_max_bytes_(std::max(opt.buffer_target_min_bytes, opt.buffer_target_max_bytes)),
+    transport_info_headers_(opt.transport_info_headers != 0),
+    request_header_timeout_in_sec_(opt.request_header_timeout_in_sec),
+    stream_progress_window_in_sec_(opt.stream_progress_window_in_sec),
+    stream_min_progress_bytes_(opt.stream_min_progress_bytes),
+    max_connections_(opt.max_connections),
+    max_connections_per_prefix_(opt.max_connections_per_prefix),
+    connection_prefix_len_v4_(opt.connection_prefix_len_v4),
+    connection_prefix_len_v6_(opt.connection_prefix_len_v6),
+    shared_crypto_(static_cast<const tQuicSharedCrypto*>(opt.shared_crypto))
 {
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.cpu = -1;
+  stats_.numa_node = -1;
+  logger_.reset(new tQuicLogger(&stats_));
+  if (opt.header_names != nullptr) {
+    header_names_.AddList(opt.header_names);
+  }
   Initialize();
 }
 
-tQuicStack::~tQuicStack() {}
+tQuicStack::~tQuicStack() {
+  // Sessions may still log while being torn down.
+  dispatcher_.reset();
+}
+
+tQuicStackConfig tQuicStack::ConfigWithDefaults(const tQuicStackConfig& opt) {
+  tQuicStackConfig config = opt;
+
+  if (config.max_streams_per_connection <= 0) {
+    config.max_streams_per_connection = 100;
+  }
+  if (config.max_unidirectional_streams_per_connection <= 0) {
+    config.max_unidirectional_streams_per_connection = 8;
+  }
+  if (config.max_streams_per_connection_limit <= 0) {
+    config.max_streams_per_connection_limit = 4 * config.max_streams_per_connection;
+  }
+
+  if (config.initial_idle_timeout_in_sec <= 0) {
+    config.initial_idle_timeout_in_sec = 10;
+  }
+  if (config.max_idle_timeout_in_sec <= 0) {
+    config.max_idle_timeout_in_sec = 60 * 10;
+  }
+  if (config.max_time_before_crypto_handshake_in_sec <= 0) {
+    config.max_time_before_crypto_handshake_in_sec = 15;
+  }
+
+  if (config.initial_stream_flow_control_window == 0) {
+    config.initial_stream_flow_control_window = 1024 * 1024;
+  }
+  if (config.initial_session_flow_control_window == 0) {
+    config.initial_session_flow_control_window = 16 * 1024 * 1024;
+  }
+
+  if (config.max_connection_age_in_sec < 0) {
+    config.max_connection_age_in_sec = 0;
+  }
+  if (config.max_connection_age_grace_in_sec <= 0) {
+    config.max_connection_age_grace_in_sec = 30;
+  }
+
+  if (config.busy_poll_us < 0) {
+    config.busy_poll_us = 0;
+  }
+
+  if (config.buffer_target_min_bytes == 0) {
+    config.buffer_target_min_bytes = 64 * 1024;
+  }
+  if (config.buffer_target_max_bytes == 0) {
+    config.buffer_target_max_bytes = 4 * 1024 * 1024;
+  }
+
+  if (config.request_header_timeout_in_sec < 0) {
+    config.request_header_timeout_in_sec = 0;
+  }
+  if (config.stream_progress_window_in_sec < 0) {
+    config.stream_progress_window_in_sec = 0;
+  }
+  if (config.stream_min_progress_bytes == 0) {
+    config.stream_min_progress_bytes = 1;
+  }
+
+  config.connection_prefix_len_v4 = config.connection_prefix_len_v4 > 0
+    ? std::min(config.connection_prefix_len_v4, 32) : 32;
+  config.connection_prefix_len_v6 = config.connection_prefix_len_v6 > 0
+    ? std::min(config.connection_prefix_len_v6, 128) : 64;
+
+  return config;
+}
 
 void tQuicStack::AddCertificate(const tQuicServerIdentify& qsi) {
   nginx::tQuicProofSource* proof_source =
@@ -68,9 +224,72 @@ void tQuicStack::AddCertificate(const tQuicServerIdentify& qsi) {
     base::FilePath(qsi.cert_path), base::FilePath(qsi.key_path));
 
   if (!qsi_mgr_.AddServerIdentify(qsi)) {
-    std::cout << "[WARNING] AddServerIdentify failed." << std::endl;
+    TQUIC_LOG(logger(), QUIC_LOG_MODULE_STACK, QUIC_LOG_WARN,
+              "AddServerIdentify %s failed", qsi.name.c_str());
+    return;
+  }
+}
+
+size_t tQuicStack::AddCertificates(
+    const std::vector<tQuicServerIdentify>& qsis,
+    int threads,
+    std::vector<bool>* loaded) {
+  loaded->assign(qsis.size(), false);
+
+  nginx::tQuicProofSource* proof_source =
+    static_cast<nginx::tQuicProofSource*>(crypto_config_.proof_source());
+
+  if (proof_source == nullptr) {
+    return 0;
+  }
+
+  std::vector<std::pair<std::string, std::string>> paths;
+  paths.reserve(qsis.size());
+  for (const tQuicServerIdentify& qsi : qsis) {
+    paths.emplace_back(qsi.cert_path, qsi.key_path);
+  }
+
+  std::vector<tQuicProofSource::LoadedChain> chains;
+  tQuicProofSource::LoadCertificateChains(paths, threads, &chains);
+
+  // Added in the caller's order so a later certificate still wins a name
+  // shared with an earlier one, as with one by one registration.
+  size_t added = 0;
+  for (size_t i = 0; i < chains.size(); i++) {
+    if (!chains[i].ok) {
+      TQUIC_LOG(logger(), QUIC_LOG_MODULE_CRYPTO, QUIC_LOG_WARN,
+                "certificate %s of %s not loaded",
+                qsis[i].cert_path.c_str(), qsis[i].name.c_str());
+      continue;
+    }
+    proof_source->AddLoadedCertificateChain(
+      chains[i].chain, std::move(chains[i].key), chains[i].hosts);
+    (*loaded)[i] = true;
+    added++;
+
+    if (!qsi_mgr_.AddServerIdentify(qsis[i])) {
+      TQUIC_LOG(logger(), QUIC_LOG_MODULE_STACK, QUIC_LOG_WARN,
+                "AddServerIdentify %s failed", qsis[i].name.c_str());
+    }
+  }
+  return added;
+}
+
+void tQuicStack::AddSharedCertificates() {
+  nginx::tQuicProofSource* proof_source =
+    static_cast<nginx::tQuicProofSource*>(crypto_config_.proof_source());
+
+  if (proof_source == nullptr) {
     return;
   }
+
+  for (const tQuicSharedCrypto::Certificate& cert : shared_crypto_->certificates()) {
+    proof_source->AddLoadedCertificateChain(cert.chain, cert.key, cert.hosts);
+    if (!qsi_mgr_.AddServerIdentify(cert.qsi)) {
+      TQUIC_LOG(logger(), QUIC_LOG_MODULE_STACK, QUIC_LOG_WARN,
+                "AddServerIdentify %s failed", cert.qsi.name.c_str());
+    }
+  }
 }
 
 void tQuicStack::InitializeWithWriter(int fd, tQuicOnCanWriteCallback write_blocked_cb)
@@ -78,11 +297,175 @@ void tQuicStack::InitializeWithWriter(int fd, tQuicOnCanWriteCallback write_bloc
   if (dispatcher_ == nullptr) {
     return;
   }
-  dispatcher_->InitializeWithWriter(
-    new quic::QuicSendmmsgBatchWriter(
-            std::unique_ptr<quic::QuicBatchWriterBuffer>(new quic::QuicBatchWriterBuffer()),
-            fd));
+  if (deferred_flush_) {
+    tQuicDeferredWriter* writer = new tQuicDeferredWriter(fd, &stats_);
+    deferred_writers_.push_back(writer);
+    dispatcher_->InitializeWithWriter(writer);
+  } else {
+    dispatcher_->InitializeWithWriter(
+      new quic::QuicSendmmsgBatchWriter(
+              std::unique_ptr<quic::QuicBatchWriterBuffer>(new quic::QuicBatchWriterBuffer()),
+              fd));
+  }
   dispatcher_->SetWriteBlockedCallback(write_blocked_cb);
+  if (poller_ != nullptr) {
+    poller_->AddSocket(fd, busy_poll_us_);
+  }
+}
+
+bool tQuicStack::AddWriter(int fd, const QuicSocketAddress& self_addr)
+{
+  if (dispatcher_ == nullptr || !self_addr.IsInitialized()) {
+    return false;
+  }
+  if (deferred_flush_) {
+    auto writer = std::make_unique<tQuicDeferredWriter>(fd, &stats_);
+    deferred_writers_.push_back(writer.get());
+    dispatcher_->AddWriter(self_addr, std::move(writer));
+  } else {
+    dispatcher_->AddWriter(
+      self_addr,
+      std::make_unique<quic::QuicSendmmsgBatchWriter>(
+              std::unique_ptr<quic::QuicBatchWriterBuffer>(new quic::QuicBatchWriterBuffer()),
+              fd));
+  }
+  if (poller_ != nullptr) {
+    poller_->AddSocket(fd, busy_poll_us_);
+  }
+  return true;
+}
+
+void tQuicStack::SetWritableCallback(tQuicOnCanWriteCallback writable_cb)
+{
+  if (dispatcher_ == nullptr) {
+    return;
+  }
+  dispatcher_->SetWritableCallback(writable_cb);
+}
+
+void tQuicStack::SetSocketCallback(tQuicSocketCallback socket_cb)
+{
+  if (dispatcher_ == nullptr) {
+    return;
+  }
+  dispatcher_->SetSocketCallback(socket_cb);
+}
+
+void tQuicStack::SetConnectionCallback(tQuicConnectionCallback conn_cb)
+{
+  if (dispatcher_ == nullptr) {
+    return;
+  }
+  dispatcher_->SetConnectionCallback(conn_cb);
+}
+
+void tQuicStack::UpdateConfig(const tQuicStackConfig& opt)
+{
+  if (dispatcher_ == nullptr) {
+    return;
+  }
+
+  // config_ is read by the dispatcher for every new session.
+  if (opt.max_streams_per_connection > 0) {
+    max_streams_per_connection_ = opt.max_streams_per_connection;
+    config_.SetMaxBidirectionalStreamsToSend(max_streams_per_connection_);
+  }
+  if (opt.max_unidirectional_streams_per_connection > 0) {
+    max_unidirectional_streams_per_connection_ = opt.max_unidirectional_streams_per_connection;
+    config_.SetMaxUnidirectionalStreamsToSend(max_unidirectional_streams_per_connection_);
+  }
+  max_streams_auto_tune_ = opt.max_streams_auto_tune != 0;
+  if (opt.max_streams_per_connection_limit > 0) {
+    max_streams_per_connection_limit_ = opt.max_streams_per_connection_limit;
+  }
+  max_streams_per_connection_limit_ =
+    std::max(max_streams_per_connection_, max_streams_per_connection_limit_);
+  max_open_streams_total_ = opt.max_open_streams_total;
+  dispatcher_->SetStreamLimitTuning(max_streams_auto_tune_,
+                                    max_streams_per_connection_,
+                                    max_streams_per_connection_limit_,
+                                    max_open_streams_total_);
+  if (opt.initial_idle_timeout_in_sec > 0) {
+    initial_idle_timeout_in_sec_ = opt.initial_idle_timeout_in_sec;
+    config_.set_max_idle_time_before_crypto_handshake(
+        QuicTime::Delta::FromSeconds(initial_idle_timeout_in_sec_));
+  }
+  if (opt.max_time_before_crypto_handshake_in_sec > 0) {
+    max_time_before_crypto_handshake_in_sec_ = opt.max_time_before_crypto_handshake_in_sec;
+    config_.set_max_time_before_crypto_handshake(
+        QuicTime::Delta::FromSeconds(max_time_before_crypto_handshake_in_sec_));
+  }
+  if (opt.initial_stream_flow_control_window > 0) {
+    initial_stream_flow_control_window_ = opt.initial_stream_flow_control_window;
+    config_.SetInitialStreamFlowControlWindowToSend(initial_stream_flow_control_window_);
+  }
+  if (opt.initial_session_flow_control_window > 0) {
+    initial_session_flow_control_window_ = opt.initial_session_flow_control_window;
+    config_.SetInitialSessionFlowControlWindowToSend(initial_session_flow_control_window_);
+  }
+
+  // The idle timeout is enforced locally, established connections follow.
+  size_t updated = 0;
+  if (opt.max_idle_timeout_in_sec > 0 &&
+      static_cast<uint64_t>(opt.max_idle_timeout_in_sec) != max_idle_timeout_in_sec_) {
+    max_idle_timeout_in_sec_ = opt.max_idle_timeout_in_sec;
+    config_.SetIdleNetworkTimeout(QuicTime::Delta::FromSeconds(max_idle_timeout_in_sec_));
+    updated = dispatcher_->UpdateIdleTimeout(
+        QuicTime::Delta::FromSeconds(max_idle_timeout_in_sec_));
+  }
+
+  max_connection_age_in_sec_ =
+    opt.max_connection_age_in_sec > 0 ? opt.max_connection_age_in_sec : 0;
+  if (opt.max_connection_age_grace_in_sec > 0) {
+    max_connection_age_grace_in_sec_ = opt.max_connection_age_grace_in_sec;
+  }
+  dispatcher_->SetMaxConnectionAge(
+      QuicTime::Delta::FromSeconds(max_connection_age_in_sec_),
+      QuicTime::Delta::FromSeconds(max_connection_age_grace_in_sec_));
+
+  connected_udp_threshold_bps_ = opt.connected_udp_threshold_bps;
+  dispatcher_->SetConnectedUdpThreshold(
+      QuicBandwidth::FromBitsPerSecond(connected_udp_threshold_bps_));
+
+  transport_info_headers_ = opt.transport_info_headers != 0;
+  dispatcher_->set_transport_info_headers(transport_info_headers_);
+
+  adaptive_buffer_limit_ = opt.adaptive_buffer_limit != 0;
+  if (opt.buffer_target_min_bytes > 0) {
+    buffer_target_min_bytes_ = opt.buffer_target_min_bytes;
+  }
+  if (opt.buffer_target_max_bytes > 0) {
+    buffer_target_max_bytes_ = opt.buffer_target_max_bytes;
+  }
+  buffer_target_max_bytes_ = std::max(buffer_target_min_bytes_, buffer_target_max_bytes_);
+
+  request_header_timeout_in_sec_ =
+    opt.request_header_timeout_in_sec > 0 ? opt.request_header_timeout_in_sec : 0;
+  stream_progress_window_in_sec_ =
+    opt.stream_progress_window_in_sec > 0 ? opt.stream_progress_window_in_sec : 0;
+  if (opt.stream_min_progress_bytes > 0) {
+    stream_min_progress_bytes_ = opt.stream_min_progress_bytes;
+  }
+  dispatcher_->SetStreamProgressLimits(
+      QuicTime::Delta::FromSeconds(request_header_timeout_in_sec_),
+      QuicTime::Delta::FromSeconds(stream_progress_window_in_sec_),
+      stream_min_progress_bytes_);
+
+  max_connections_ = opt.max_connections;
+  max_connections_per_prefix_ = opt.max_connections_per_prefix;
+  if (opt.connection_prefix_len_v4 > 0) {
+    connection_prefix_len_v4_ = std::min(opt.connection_prefix_len_v4, 32);
+  }
+  if (opt.connection_prefix_len_v6 > 0) {
+    connection_prefix_len_v6_ = std::min(opt.connection_prefix_len_v6, 128);
+  }
+  dispatcher_->SetConnectionLimits(max_connections_, max_connections_per_prefix_,
+                                   connection_prefix_len_v4_,
+                                   connection_prefix_len_v6_);
+
+  stats_.config_updates++;
+  TQUIC_LOG(logger(), QUIC_LOG_MODULE_STACK, QUIC_LOG_INFO,
+            "config updated, idle timeout applied to %zu connections", updated);
 }
 
 void tQuicStack::ProcessBufferedChlos(size_t max_connections_to_create)
@@ -102,6 +485,19 @@ void tQuicStack::ProcessPacket(
     return;
   }
 
+  // A packet read by the host in interrupt mode re-arms busy polling.
+  if (empty_polls_ >= kMaxEmptyPolls) {
+    empty_polls_ = 0;
+    stats_.busy_poll_idle = 0;
+  }
+  ProcessPolledPacket(self_addr, peer_addr, buffer, length);
+}
+
+void tQuicStack::ProcessPolledPacket(
+    const QuicSocketAddress& self_addr,
+    const QuicSocketAddress& peer_addr,
+    char* buffer, size_t length)
+{
   QuicWallTime walltimestamp = clock_.WallNow();
   QuicTime timestamp = clock_.ConvertWallTimeToQuicTime(walltimestamp);
   QuicReceivedPacket packet(buffer, length, timestamp, false);
@@ -129,7 +525,36 @@ bool tQuicStack::HasPendingWrites()
   if (dispatcher_ == nullptr) {
     return false;
   }
-  return dispatcher_->HasPendingWrites();
+  if (dispatcher_->HasPendingWrites()) {
+    return true;
+  }
+  for (tQuicDeferredWriter* writer : deferred_writers_) {
+    if (writer->HasPending()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void tQuicStack::Flush()
+{
+  if (dispatcher_ == nullptr) {
+    return;
+  }
+
+  bool blocked = false;
+  for (tQuicDeferredWriter* writer : deferred_writers_) {
+    WriteResult result = writer->FlushDeferred();
+    if (IsWriteBlockedStatus(result.status)) {
+      blocked = true;
+    }
+  }
+
+  // The remaining packets go out with the next flush once the host saw
+  // the socket writable and called quic_stack_on_can_write.
+  if (blocked) {
+    dispatcher_->OnFlushBlocked();
+  }
 }
 
 tQuicServerSession* tQuicStack::GetSession(const tQuicRequestID& id)
@@ -206,9 +631,46 @@ int tQuicStack::WriteResponseBody(
     return QUIC_STACK_SERVER;
   }
 
+  if (limit == 0 && adaptive_buffer_limit_) {
+    limit = stream->RecommendedBufferSize(
+      buffer_target_min_bytes_, buffer_target_max_bytes_);
+  }
+
   return stream->WriteResponseBody(data, len, trailers, trailers_len, limit, fin);
 }
 
+int tQuicStack::WriteUpstreamResponse(
+  const tQuicRequestID& id,
+  const char* data,
+  size_t len,
+  bool eof,
+  int* complete)
+{
+  tQuicServerStream* stream = GetStream(id);
+  if (stream == nullptr) {
+    return QUIC_STACK_SERVER;
+  }
+
+  bool done = false;
+  int rc = stream->WriteUpstreamResponse(data, len, eof, &done);
+  if (complete != nullptr) {
+    *complete = done ? 1 : 0;
+  }
+  return rc;
+}
+
+int tQuicStack::BufferTarget(const tQuicRequestID& id, size_t* target)
+{
+  tQuicServerStream* stream = GetStream(id);
+  if (stream == nullptr) {
+    return QUIC_STACK_SERVER;
+  }
+
+  *target = stream->RecommendedBufferSize(
+    buffer_target_min_bytes_, buffer_target_max_bytes_);
+  return QUIC_STACK_OK;
+}
+
 void tQuicStack::CloseStream(const tQuicRequestID& id)
 {
   tQuicServerSession* session = GetSession(id);
@@ -249,229 +711,278 @@ void tQuicStack::OnAlarmTimeout(int64_t deadline_ms)
   quic_alarm_evq_->CallTimeoutAlarms(deadline_ms * 1000);
 }
 
-void tQuicStack::Initialize()
+void tQuicStack::GetStats(tQuicStackStats* stats)
 {
-  const uint32_t kInitialSessionFlowControlWindow = 16 * 1024 * 1024;  // 16 MB
-  const uint32_t kInitialStreamFlowControlWindow = 1024 * 1024;         // 1024 KB
+  memcpy(stats, &stats_, sizeof(stats_));
+}
 
-  if (config_.GetInitialStreamFlowControlWindowToSend() ==
-      kDefaultFlowControlSendWindow) {
-    config_.SetInitialStreamFlowControlWindowToSend(
-        kInitialStreamFlowControlWindow);
-  }
-  if (config_.GetInitialSessionFlowControlWindowToSend() ==
-      kDefaultFlowControlSendWindow) {
-    config_.SetInitialSessionFlowControlWindowToSend(
-        kInitialSessionFlowControlWindow);
+bool tQuicStack::SetPreferredAddress(const QuicSocketAddress& address)
+{
+  if (dispatcher_ == nullptr || !address.IsInitialized()) {
+    return false;
   }
+  dispatcher_->SetPreferredAddress(address);
+  return true;
+}
 
-  if (config_.GetMaxBidirectionalStreamsToSend() ==
-      kDefaultMaxStreamsPerConnection) {
-    config_.SetMaxBidirectionalStreamsToSend(
-        max_streams_per_connection_);
-  }
-  if (config_.GetMaxUnidirectionalStreamsToSend() ==
-      kDefaultMaxStreamsPerConnection) {
-    config_.SetMaxUnidirectionalStreamsToSend(
-        max_streams_per_connection_);
+void tQuicStack::ClearPreferredAddress()
+{
+  if (dispatcher_ == nullptr) {
+    return;
   }
+  dispatcher_->ClearPreferredAddress();
+}
 
-  if (config_.max_idle_time_before_crypto_handshake() ==
-      QuicTime::Delta::FromSeconds(kInitialIdleTimeoutSecs)) {
-    config_.set_max_idle_time_before_crypto_handshake(
-        QuicTime::Delta::FromSeconds(initial_idle_timeout_in_sec_));
+void tQuicStack::Drain(int64_t deadline_ms)
+{
+  if (dispatcher_ == nullptr) {
+    return;
   }
+  dispatcher_->Drain(QuicTime::Zero() + QuicTime::Delta::FromMilliseconds(deadline_ms));
+}
 
-  config_.SetIdleNetworkTimeout(QuicTime::Delta::FromSeconds(max_idle_timeout_in_sec_));
+int tQuicStack::SetStreamDeliveryRate(
+  const tQuicRequestID& id,
+  uint64_t rate_bps,
+  uint64_t burst_bytes)
+{
+  tQuicServerStream* stream = GetStream(id);
+  if (stream == nullptr) {
+    return QUIC_STACK_SERVER;
+  }
 
-  if (config_.max_time_before_crypto_handshake() ==
-      QuicTime::Delta::FromSeconds(kMaxTimeForCryptoHandshakeSecs)) {
-    config_.set_max_time_before_crypto_handshake(
-        QuicTime::Delta::FromSeconds(max_time_before_crypto_handshake_in_sec_));
+  if (rate_bps > 0) {
+    stats_.rate_limited_streams++;
   }
+  stream->SetMaxDeliveryRate(
+    QuicBandwidth::FromBitsPerSecond(rate_bps), burst_bytes, &stats_);
+  return QUIC_STACK_OK;
+}
 
-  { // init CryptoHandshakeMessage firstly
-    InitializeConfigOptions();
-    QuicServerConfigProtobuf config_pb = GenerateConfigProtobuf(QuicRandom::GetInstance(),
-		    &clock_, crypto_config_options_);
-    std::unique_ptr<CryptoHandshakeMessage> scfg(
-		    crypto_config_.AddConfig(config_pb, clock_.WallNow()));
+int tQuicStack::SetConnectionDeliveryRate(
+  const tQuicRequestID& id,
+  uint64_t rate_bps,
+  uint64_t burst_bytes)
+{
+  tQuicServerSession* session = GetSession(id);
+  if (session == nullptr) {
+    return QUIC_STACK_SERVER;
   }
 
-  std::unique_ptr<tQuicAlarmFactory> alarm_factory(new tQuicAlarmFactory);
-  quic_alarm_evq_ = alarm_factory->quic_alarm_event_queue();
-  QUIC_DLOG(INFO) << "tQuicDispatcher Initialize ";
-  dispatcher_.reset(
-    new tQuicDispatcher(
-      &config_, &crypto_config_, &version_manager_,
-      std::unique_ptr<tQuicConnectionHelper>(
-        new tQuicConnectionHelper(&clock_, QuicAllocator::BUFFER_POOL)),
-      std::unique_ptr<QuicCryptoServerStream::Helper>(
-        new tQuicCryptoServerStream),
-      std::move(alarm_factory),
-      expected_connection_id_length_,
-      stack_ctx_,
-      callback_,
-      &qsi_mgr_));
+  session->SetMaxDeliveryRate(
+    QuicBandwidth::FromBitsPerSecond(rate_bps), burst_bytes);
+  return QUIC_STACK_OK;
+}
 
+bool tQuicStack::BindCpu(int cpu)
+{
+  int numa_node = CpuNumaNode(cpu);
+  if (!BindThreadToCpu(cpu, numa_node)) {
+    return false;
+  }
+  stats_.cpu = cpu;
+  stats_.numa_node = numa_node;
+  return true;
 }
 
-void tQuicStack::InitializeConfigOptions() {
-    char host_name[64];
-    if(gethostname(host_name, sizeof(host_name))) {
-        std::cout << "[WARNING] get host_name failed." << std::endl;
-        return;
-    }
-    std::string host_name_str = host_name;
-    std::string host_name_prefix = host_name_str.substr(0, host_name_str.find_last_of('-') + 1);
-    if (host_name_prefix.empty()) {
-        std::cout << "[WARNING] get host_name_prefix failed." << std::endl;
-        return;
+int tQuicStack::SampleIncomingCpu(int fd)
+{
+  int cpu = IncomingCpu(fd);
+  if (cpu < 0) {
+    return -1;
+  }
+  stats_.incoming_cpu_samples++;
+  if (stats_.cpu >= 0 && cpu != stats_.cpu) {
+    stats_.incoming_cpu_mismatches++;
+  }
+  return cpu;
+}
+
+int tQuicStack::Poll(int64_t budget_us)
+{
+  if (dispatcher_ == nullptr || poller_ == nullptr || poller_->empty()) {
+    return 0;
+  }
+
+  // Interrupt mode while there is nothing latency sensitive to serve or
+  // until the host reads a packet again after the last empty polls.
+  if (dispatcher_->NumSessions() == 0 || empty_polls_ >= kMaxEmptyPolls) {
+    stats_.busy_poll_idle = 1;
+    return 0;
+  }
+
+  int64_t cpu_start = ThreadCpuTimeInUsec();
+  QuicTime deadline = clock_.Now() + QuicTime::Delta::FromMicroseconds(budget_us);
+  tQuicPoller::PacketHandler handler =
+    [this](const QuicSocketAddress& self_addr,
+           const QuicSocketAddress& peer_addr,
+           char* buffer, size_t length) {
+      ProcessPolledPacket(self_addr, peer_addr, buffer, length);
+    };
+
+  int packets = 0;
+  do {
+    int n = poller_->PollOnce(handler);
+    packets += n;
+    // Sockets drained, yield so the host can write the responses.
+    if (n == 0 && packets > 0) {
+      break;
+    }
+  } while (clock_.Now() < deadline);
+
+  stats_.busy_poll_calls++;
+  stats_.busy_poll_packets += packets;
+  stats_.busy_poll_cpu_us += ThreadCpuTimeInUsec() - cpu_start;
+  if (packets == 0) {
+    stats_.busy_poll_empty++;
+    if (++empty_polls_ >= kMaxEmptyPolls) {
+      stats_.busy_poll_idle = 1;
     }
-    uint8_t scid_bytes[SHA256_DIGEST_LENGTH];
-    SHA256(reinterpret_cast<const uint8_t*>(host_name_prefix.data()),
-           host_name_prefix.size(), scid_bytes);
-
-    crypto_config_options_.id = std::string(reinterpret_cast<const char*>(scid_bytes), 16);
-    crypto_config_options_.orbit = std::string(reinterpret_cast<const char*>(scid_bytes), 8);
-    crypto_config_options_.expiry_time = QuicWallTime::FromUNIXMicroseconds(scfgExpiryTime);
-} 
-
-QuicServerConfigProtobuf tQuicStack::GenerateConfigProtobuf(
-    QuicRandom* rand,
-    const QuicClock* clock,
-    const QuicCryptoServerConfig::ConfigOptions& options) {
-  CryptoHandshakeMessage msg;
-  std::string curve25519_private_key; 
-  if (options.id.empty()) {
-      curve25519_private_key =
-          Curve25519KeyExchange::NewPrivateKey(rand);
-  } else {
-      uint8_t private_key_bytes[32];
-      SHA256(reinterpret_cast<const uint8_t*>(options.id.data()),
-           options.id.size(), private_key_bytes);
-      curve25519_private_key = 
-          std::string(reinterpret_cast<const char*>(private_key_bytes),
-                      sizeof(private_key_bytes));
-  }
-
-  std::unique_ptr<Curve25519KeyExchange> curve25519 =
-      Curve25519KeyExchange::New(curve25519_private_key);
-  quiche::QuicheStringPiece curve25519_public_value =
-      curve25519->public_value();
-
-  std::string encoded_public_values;
-  // First three bytes encode the length of the public value.
-  QUICHE_DCHECK_LT(curve25519_public_value.size(), (1U << 24));
-  encoded_public_values.push_back(
-      static_cast<char>(curve25519_public_value.size()));
-  encoded_public_values.push_back(
-      static_cast<char>(curve25519_public_value.size() >> 8));
-  encoded_public_values.push_back(
-      static_cast<char>(curve25519_public_value.size() >> 16));
-  encoded_public_values.append(curve25519_public_value.data(),
-                               curve25519_public_value.size());
-
-  std::string p256_private_key;
-  if (options.p256) {
-    p256_private_key = P256KeyExchange::NewPrivateKey();
-    std::unique_ptr<P256KeyExchange> p256(
-        P256KeyExchange::New(p256_private_key));
-    quiche::QuicheStringPiece p256_public_value = p256->public_value();
-
-    QUICHE_DCHECK_LT(p256_public_value.size(), (1U << 24));
-    encoded_public_values.push_back(
-        static_cast<char>(p256_public_value.size()));
-    encoded_public_values.push_back(
-        static_cast<char>(p256_public_value.size() >> 8));
-    encoded_public_values.push_back(
-        static_cast<char>(p256_public_value.size() >> 16));
-    encoded_public_values.append(p256_public_value.data(),
-                                 p256_public_value.size());
-  }
-
-  msg.set_tag(kSCFG);
-  if (options.p256) {
-    msg.SetVector(kKEXS, QuicTagVector{kC255, kP256});
   } else {
-    msg.SetVector(kKEXS, QuicTagVector{kC255});
+    empty_polls_ = 0;
   }
-  msg.SetVector(kAEAD, QuicTagVector{kAESG, kCC20});
-  msg.SetStringPiece(kPUBS, encoded_public_values);
+  return packets;
+}
 
-  if (options.expiry_time.IsZero()) {
-    const QuicWallTime now = clock->WallNow();
-    const QuicWallTime expiry = now.Add(QuicTime::Delta::FromSeconds(
-        60 * 60 * 24 * 180 /* 180 days, ~six months */));
-    const uint64_t expiry_seconds = expiry.ToUNIXSeconds();
-    msg.SetValue(kEXPY, expiry_seconds);
-  } else {
-    msg.SetValue(kEXPY, options.expiry_time.ToUNIXSeconds());
+void tQuicStack::SetTenantWeight(const tQuicServerCtx* server_ctx,
+                                 uint32_t weight,
+                                 uint64_t max_rate_bps)
+{
+  if (dispatcher_ == nullptr) {
+    return;
   }
+  dispatcher_->tenants()->SetWeight(
+    server_ctx ? server_ctx->server_conf : nullptr, weight,
+    QuicBandwidth::FromBitsPerSecond(max_rate_bps));
+}
 
-  char orbit_bytes[kOrbitSize];
-  if (options.orbit.size() == sizeof(orbit_bytes)) {
-    memcpy(orbit_bytes, options.orbit.data(), sizeof(orbit_bytes));
-  } else {
-    QUICHE_DCHECK(options.orbit.empty());
-    rand->RandBytes(orbit_bytes, sizeof(orbit_bytes));
-  }
-  msg.SetStringPiece(
-      kORBT, quiche::QuicheStringPiece(orbit_bytes, sizeof(orbit_bytes)));
-
-  if (options.channel_id_enabled) {
-    msg.SetVector(kPDMD, QuicTagVector{kCHID});
-  }
-
-  if (options.id.empty()) {
-    // We need to ensure that the SCID changes whenever the server config does
-    // thus we make it a hash of the rest of the server config.
-    std::unique_ptr<QuicData> serialized =
-        CryptoFramer::ConstructHandshakeMessage(msg);
-
-    uint8_t scid_bytes[SHA256_DIGEST_LENGTH];
-    SHA256(reinterpret_cast<const uint8_t*>(serialized->data()),
-           serialized->length(), scid_bytes);
-    // The SCID is a truncated SHA-256 digest.
-    static_assert(16 <= SHA256_DIGEST_LENGTH, "SCID length too high.");
-    msg.SetStringPiece(kSCID,
-                       quiche::QuicheStringPiece(
-                           reinterpret_cast<const char*>(scid_bytes), 16));
-  } else {
-    msg.SetStringPiece(kSCID, options.id);
+bool tQuicStack::GetTenantStats(const tQuicServerCtx* server_ctx,
+                                tQuicTenantStats* stats)
+{
+  if (dispatcher_ == nullptr) {
+    return false;
   }
-  // Don't put new tags below this point. The SCID generation should hash over
-  // everything but itself and so extra tags should be added prior to the
-  // preceding if block.
+  return dispatcher_->tenants()->GetStats(
+    server_ctx ? server_ctx->server_conf : nullptr, stats);
+}
 
-  std::unique_ptr<QuicData> serialized =
-      CryptoFramer::ConstructHandshakeMessage(msg);
+ParsedQuicVersionVector tQuicStack::SupportedVersions()
+{
+  return version_manager_.GetSupportedVersions();
+}
 
-  QuicServerConfigProtobuf config;
-  config.set_config(std::string(serialized->AsStringPiece()));
-  QuicServerConfigProtobuf::PrivateKey* curve25519_key = config.add_key();
-  curve25519_key->set_tag(kC255);
-  curve25519_key->set_private_key(curve25519_private_key);
+void tQuicStack::Initialize()
+{
+  if (config_.GetInitialStreamFlowControlWindowToSend() ==
+      kDefaultFlowControlSendWindow) {
+    config_.SetInitialStreamFlowControlWindowToSend(
+        initial_stream_flow_control_window_);
+  }
+  if (config_.GetInitialSessionFlowControlWindowToSend() ==
+      kDefaultFlowControlSendWindow) {
+    config_.SetInitialSessionFlowControlWindowToSend(
+        initial_session_flow_control_window_);
+  }
 
-  if (options.p256) {
-    QuicServerConfigProtobuf::PrivateKey* p256_key = config.add_key();
-    p256_key->set_tag(kP256);
-    p256_key->set_private_key(p256_private_key);
+  if (config_.GetMaxBidirectionalStreamsToSend() ==
+      kDefaultMaxStreamsPerConnection) {
+    config_.SetMaxBidirectionalStreamsToSend(
+        max_streams_per_connection_);
+  }
+  if (config_.GetMaxUnidirectionalStreamsToSend() ==
+      kDefaultMaxStreamsPerConnection) {
+    config_.SetMaxUnidirectionalStreamsToSend(
+        max_unidirectional_streams_per_connection_);
   }
 
-  return config;
-} 
+  if (config_.max_idle_time_before_crypto_handshake() ==
+      QuicTime::Delta::FromSeconds(kInitialIdleTimeoutSecs)) {
+    config_.set_max_idle_time_before_crypto_handshake(
+        QuicTime::Delta::FromSeconds(initial_idle_timeout_in_sec_));
+  }
+
+  config_.SetIdleNetworkTimeout(QuicTime::Delta::FromSeconds(max_idle_timeout_in_sec_));
+
+  if (config_.max_time_before_crypto_handshake() ==
+      QuicTime::Delta::FromSeconds(kMaxTimeForCryptoHandshakeSecs)) {
+    config_.set_max_time_before_crypto_handshake(
+        QuicTime::Delta::FromSeconds(max_time_before_crypto_handshake_in_sec_));
+  }
+
+  if (!disable_gquic_ && shared_crypto_ != nullptr &&
+      shared_crypto_->has_server_config()) {
+    // Prepared by the master, only parsed here.
+    crypto_config_options_ = shared_crypto_->config_options();
+    std::unique_ptr<CryptoHandshakeMessage> scfg(
+		    crypto_config_.AddConfig(shared_crypto_->server_config(), clock_.WallNow()));
+  } else if (!disable_gquic_) { // init CryptoHandshakeMessage firstly
+    InitializeConfigOptions();
+    QuicServerConfigProtobuf config_pb = tQuicSharedCrypto::GenerateConfigProtobuf(
+		    QuicRandom::GetInstance(), &clock_, crypto_config_options_);
+    std::unique_ptr<CryptoHandshakeMessage> scfg(
+		    crypto_config_.AddConfig(config_pb, clock_.WallNow()));
+  }
+
+  if (shared_crypto_ != nullptr) {
+    AddSharedCertificates();
+  }
+
+  std::unique_ptr<tQuicAlarmFactory> alarm_factory(new tQuicAlarmFactory);
+  quic_alarm_evq_ = alarm_factory->quic_alarm_event_queue();
+  TQUIC_LOG(logger(), QUIC_LOG_MODULE_STACK, QUIC_LOG_DEBUG,
+            "tQuicDispatcher Initialize");
+  dispatcher_.reset(
+    new tQuicDispatcher(
+      &config_, &crypto_config_, &version_manager_,
+      std::unique_ptr<tQuicConnectionHelper>(
+        new tQuicConnectionHelper(&clock_, QuicAllocator::BUFFER_POOL)),
+      std::unique_ptr<QuicCryptoServerStream::Helper>(
+        new tQuicCryptoServerStream),
+      std::move(alarm_factory),
+      expected_connection_id_length_,
+      stack_ctx_,
+      callback_,
+      &qsi_mgr_,
+      &stats_));
+  dispatcher_->set_logger(logger_.get());
+  dispatcher_->SetMaxConnectionAge(
+      QuicTime::Delta::FromSeconds(max_connection_age_in_sec_),
+      QuicTime::Delta::FromSeconds(max_connection_age_grace_in_sec_));
+  dispatcher_->SetConnectedUdpThreshold(
+      QuicBandwidth::FromBitsPerSecond(connected_udp_threshold_bps_));
+  dispatcher_->set_deferred_flush(deferred_flush_);
+  dispatcher_->set_transport_info_headers(transport_info_headers_);
+  dispatcher_->set_header_names(&header_names_);
+  dispatcher_->SetStreamLimitTuning(max_streams_auto_tune_,
+                                    max_streams_per_connection_,
+                                    max_streams_per_connection_limit_,
+                                    max_open_streams_total_);
+  dispatcher_->SetStreamProgressLimits(
+      QuicTime::Delta::FromSeconds(request_header_timeout_in_sec_),
+      QuicTime::Delta::FromSeconds(stream_progress_window_in_sec_),
+      stream_min_progress_bytes_);
+  dispatcher_->SetConnectionLimits(max_connections_, max_connections_per_prefix_,
+                                   connection_prefix_len_v4_,
+                                   connection_prefix_len_v6_);
+  if (busy_poll_us_ > 0) {
+    poller_ = std::make_unique<tQuicPoller>();
+  }
+
+}
+
+void tQuicStack::InitializeConfigOptions() {
+  if (!tQuicSharedCrypto::HostConfigOptions(&crypto_config_options_)) {
+    TQUIC_LOG(logger(), QUIC_LOG_MODULE_CRYPTO, QUIC_LOG_WARN,
+              "get host_name_prefix failed");
+  }
+}
+
 }  // namespace nginx
 
 
 ////// Stack APIs
 tQuicStackHandler quic_stack_create(const tQuicStackConfig* opt_ptr)
 {
-#if 0
-  auto logger = spdlog::basic_logger_mt("nginx-quic-module", "/data/ngxquicmodule.log");
-  quiche::GetLogger().swap(*logger);
-  quiche::SetVerbosityLogThreshold(4);
-#endif
   SetQuicReloadableFlag(quic_default_to_bbr, true);
   if (opt_ptr == nullptr) {
     return nullptr;
@@ -481,22 +992,17 @@ tQuicStackHandler quic_stack_create(const tQuicStackConfig* opt_ptr)
       opt_ptr->clock_gen.TimeNowInUsec == nullptr) {
     return nullptr;
   }
-  
-  QUIC_DLOG(INFO) << "quic_stack_create";
+
   auto stack = std::make_unique<nginx::tQuicStack>(
-    opt_ptr->stack_ctx,
-    opt_ptr->req_cb,
-    opt_ptr->clock_gen,
-    opt_ptr->max_streams_per_connection,
-    opt_ptr->initial_idle_timeout_in_sec,
-    opt_ptr->default_idle_timeout_in_sec,
-    opt_ptr->max_idle_timeout_in_sec,
-    opt_ptr->max_time_before_crypto_handshake_in_sec,
-    kQuicDefaultConnectionIdLength);
+    nginx::tQuicStack::ConfigWithDefaults(*opt_ptr));
   if (stack == nullptr) {
     return nullptr;
   }
 
+  TQUIC_LOG(stack->logger(), QUIC_LOG_MODULE_STACK, QUIC_LOG_INFO,
+            "quic_stack_create: %zu versions, gquic %s",
+            stack->SupportedVersions().size(),
+            stack->gquic_enabled() ? "on" : "off");
   return stack.release();
 }
 
@@ -510,21 +1016,93 @@ void quic_stack_add_certificate(tQuicStackHandler handler, const tQuicStackCerti
     return;
   }
 
-  if (cert_ptr->certificate == nullptr || cert_ptr->certificate_len <= 0 ||
-      cert_ptr->certificate_key == nullptr || cert_ptr->certificate_key_len <= 0 ||
-      cert_ptr->hostname == nullptr || cert_ptr->hostname_len <= 0) {
+  nginx::tQuicServerIdentify qsi;
+  if (!nginx::ServerIdentifyFromCertificate(cert_ptr, &qsi)) {
     return;
   }
 
-  nginx::tQuicServerIdentify qsi;
-  qsi.name      = std::string(cert_ptr->hostname, cert_ptr->hostname_len);
-  qsi.cert_path = std::string(cert_ptr->certificate, cert_ptr->certificate_len);
-  qsi.key_path  = std::string(cert_ptr->certificate_key, cert_ptr->certificate_key_len);
-  qsi.ctx = *cert_ptr->server_ctx;
-
   stack->AddCertificate(qsi);
 }
 
+int quic_stack_add_certificates(
+    tQuicStackHandler handler,
+    const tQuicStackCertificate* certs,
+    int cert_num,
+    int threads,
+    int* results)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || cert_num < 0 || (cert_num > 0 && certs == nullptr)) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  std::vector<nginx::tQuicServerIdentify> qsis;
+  std::vector<int> index;
+  for (int i = 0; i < cert_num; i++) {
+    nginx::tQuicServerIdentify qsi;
+    if (!nginx::ServerIdentifyFromCertificate(&certs[i], &qsi)) {
+      if (results != nullptr) {
+        results[i] = QUIC_STACK_PARAMETER;
+      }
+      continue;
+    }
+    qsis.push_back(qsi);
+    index.push_back(i);
+  }
+
+  std::vector<bool> loaded;
+  size_t added = stack->AddCertificates(qsis, threads, &loaded);
+  if (results != nullptr) {
+    for (size_t i = 0; i < index.size(); i++) {
+      results[index[i]] = loaded[i] ? QUIC_STACK_OK : QUIC_STACK_SERVER;
+    }
+  }
+  return static_cast<int>(added);
+}
+
+tQuicCryptoHandler quic_stack_crypto_create(
+    const tQuicStackCertificate* certs,
+    int cert_num,
+    int* results)
+{
+  if (cert_num < 0 || (cert_num > 0 && certs == nullptr)) {
+    return nullptr;
+  }
+
+  auto crypto = std::make_unique<nginx::tQuicSharedCrypto>();
+  crypto->PrepareServerConfig(QuicDefaultClock::Get());
+
+  std::vector<nginx::tQuicServerIdentify> qsis;
+  std::vector<int> index;
+  for (int i = 0; i < cert_num; i++) {
+    nginx::tQuicServerIdentify qsi;
+    if (!nginx::ServerIdentifyFromCertificate(&certs[i], &qsi)) {
+      if (results != nullptr) {
+        results[i] = QUIC_STACK_PARAMETER;
+      }
+      continue;
+    }
+    qsis.push_back(qsi);
+    index.push_back(i);
+  }
+
+  // No stack and so no logger yet, the host reports failures.
+  std::vector<bool> loaded;
+  crypto->AddCertificates(qsis, 0, &loaded);
+  if (results != nullptr) {
+    for (size_t i = 0; i < index.size(); i++) {
+      results[index[i]] = loaded[i] ? QUIC_STACK_OK : QUIC_STACK_SERVER;
+    }
+  }
+
+  return crypto.release();
+}
+
+void quic_stack_crypto_release(tQuicCryptoHandler crypto)
+{
+  delete static_cast<nginx::tQuicSharedCrypto*>(crypto);
+}
+
 void quic_stack_init_writer(tQuicStackHandler handler, int sockfd,
   tQuicOnCanWriteCallback write_blocked_cb)
 {
@@ -536,6 +1114,104 @@ void quic_stack_init_writer(tQuicStackHandler handler, int sockfd,
   stack->InitializeWithWriter(sockfd, write_blocked_cb);
 }
 
+int quic_stack_add_writer(
+    tQuicStackHandler handler,
+    int sockfd,
+    const struct sockaddr* self_saddr,
+    socklen_t self_len)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || sockfd < 0 || self_saddr == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  QuicSocketAddress self_addr(self_saddr, self_len);
+  if (!stack->AddWriter(sockfd, self_addr)) {
+    return QUIC_STACK_PARAMETER;
+  }
+  return QUIC_STACK_OK;
+}
+
+void quic_stack_set_writable_callback(tQuicStackHandler handler,
+  tQuicOnCanWriteCallback writable_cb)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return;
+  }
+
+  stack->SetWritableCallback(writable_cb);
+}
+
+void quic_stack_set_socket_callback(tQuicStackHandler handler,
+  tQuicSocketCallback socket_cb)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return;
+  }
+
+  stack->SetSocketCallback(socket_cb);
+}
+
+int quic_stack_set_log_file(tQuicStackHandler handler, const char* path)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || path == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  if (!stack->logger()->SetFile(path)) {
+    return QUIC_STACK_SERVER;
+  }
+  return QUIC_STACK_OK;
+}
+
+void quic_stack_set_log_callback(tQuicStackHandler handler,
+  tQuicLogCallback log_cb)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return;
+  }
+
+  stack->logger()->SetCallback(log_cb);
+}
+
+void quic_stack_set_log_level(tQuicStackHandler handler, int module, int level)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return;
+  }
+
+  stack->logger()->SetLevel(module, level);
+}
+
+int quic_stack_update_config(
+    tQuicStackHandler handler,
+    const tQuicStackConfig* opt_ptr)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || opt_ptr == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  stack->UpdateConfig(*opt_ptr);
+  return QUIC_STACK_OK;
+}
+
+void quic_stack_set_connection_callback(tQuicStackHandler handler,
+  tQuicConnectionCallback conn_cb)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return;
+  }
+
+  stack->SetConnectionCallback(conn_cb);
+}
+
 void quic_stack_process_chlos(
   tQuicStackHandler handler,
   size_t max_connection_to_create)
@@ -572,6 +1248,15 @@ void quic_stack_on_can_write(tQuicStackHandler handler)
   stack->OnCanWrite();
 }
 
+void quic_stack_flush(tQuicStackHandler handler)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return;
+  }
+  stack->Flush();
+}
+
 int quic_stack_has_chlos_buffered(tQuicStackHandler handler)
 {
   nginx::tQuicStack *stack = GET_THIS(handler);
@@ -643,6 +1328,22 @@ int quic_stack_write_response_body(
 
 }
 
+int quic_stack_write_upstream_response(
+    tQuicStackHandler handler,
+    const tQuicRequestID* id,
+    const char* data,
+    size_t len,
+    int eof,
+    int* complete)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || id == nullptr || (data == nullptr && len > 0)) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  return stack->WriteUpstreamResponse(*id, data, len, eof != 0, complete);
+}
+
 void quic_stack_close_stream(
     tQuicStackHandler handler,
     const tQuicRequestID* id)
@@ -688,7 +1389,7 @@ int quic_stack_supported_versions(
   }
 
   std::string qvl_str;
-  quic::ParsedQuicVersionVector qvv = CurrentSupportedVersions();
+  quic::ParsedQuicVersionVector qvv = stack->SupportedVersions();
   for (const auto& i : qvv) {
     if (i.handshake_protocol != quic::HandshakeProtocol::PROTOCOL_QUIC_CRYPTO) {
       continue;
@@ -707,6 +1408,194 @@ int quic_stack_supported_versions(
   return qvl_str.size();
 }
 
+int quic_stack_alt_svc(
+    tQuicStackHandler handler,
+    uint16_t port,
+    uint32_t max_age_in_sec,
+    char* buf,
+    size_t len)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || buf == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  std::string alt_svc_str;
+  std::set<std::string> alpns;
+  quic::ParsedQuicVersionVector qvv = stack->SupportedVersions();
+  for (const auto& i : qvv) {
+    std::string alpn = quic::AlpnForVersion(i);
+    if (!alpns.insert(alpn).second) {
+      continue;
+    }
+    if (!alt_svc_str.empty()) {
+      alt_svc_str.append(", ");
+    }
+    alt_svc_str.append(alpn + "=\":" + std::to_string(port) + "\"; ma=" +
+                       std::to_string(max_age_in_sec));
+  }
+
+  if (alt_svc_str.size() > len) {
+    return QUIC_STACK_SERVER;
+  }
+
+  memcpy(buf, alt_svc_str.c_str(), alt_svc_str.size());
+  return alt_svc_str.size();
+}
+
+int quic_stack_set_preferred_address(
+    tQuicStackHandler handler,
+    const struct sockaddr* addr,
+    socklen_t len)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  if (addr == nullptr) {
+    stack->ClearPreferredAddress();
+    return QUIC_STACK_OK;
+  }
+
+  QuicSocketAddress preferred_addr(addr, len);
+  if (!stack->SetPreferredAddress(preferred_addr)) {
+    return QUIC_STACK_PARAMETER;
+  }
+  return QUIC_STACK_OK;
+}
+
+void quic_stack_drain(
+    tQuicStackHandler handler,
+    int64_t deadline_ms)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return;
+  }
+
+  stack->Drain(deadline_ms);
+}
+
+int quic_stack_buffer_target(
+    tQuicStackHandler handler,
+    const tQuicRequestID* id,
+    size_t* target)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || id == nullptr || target == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  return stack->BufferTarget(*id, target);
+}
+
+int quic_stack_set_stream_rate_limit(
+    tQuicStackHandler handler,
+    const tQuicRequestID* id,
+    uint64_t rate_bps,
+    uint64_t burst_bytes)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || id == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  return stack->SetStreamDeliveryRate(*id, rate_bps, burst_bytes);
+}
+
+int quic_stack_set_connection_rate_limit(
+    tQuicStackHandler handler,
+    const tQuicRequestID* id,
+    uint64_t rate_bps,
+    uint64_t burst_bytes)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || id == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  return stack->SetConnectionDeliveryRate(*id, rate_bps, burst_bytes);
+}
+
+int quic_stack_poll(
+    tQuicStackHandler handler,
+    int64_t budget_us)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || budget_us < 0) {
+    return 0;
+  }
+
+  return stack->Poll(budget_us);
+}
+
+int quic_stack_incoming_cpu(
+    tQuicStackHandler handler,
+    int sockfd)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return nginx::IncomingCpu(sockfd);
+  }
+
+  return stack->SampleIncomingCpu(sockfd);
+}
+
+int quic_stack_bind_cpu(
+    tQuicStackHandler handler,
+    int cpu)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || cpu < 0) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  if (!stack->BindCpu(cpu)) {
+    return QUIC_STACK_SERVER;
+  }
+  return QUIC_STACK_OK;
+}
+
+int quic_stack_attach_reuseport_cpu_filter(int sockfd)
+{
+  if (!nginx::AttachReuseportCpuFilter(sockfd)) {
+    return QUIC_STACK_SERVER;
+  }
+  return QUIC_STACK_OK;
+}
+
+int quic_stack_set_tenant_weight(
+    tQuicStackHandler handler,
+    const tQuicServerCtx* server_ctx,
+    uint32_t weight,
+    uint64_t max_rate_bps)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  stack->SetTenantWeight(server_ctx, weight, max_rate_bps);
+  return QUIC_STACK_OK;
+}
+
+int quic_stack_get_tenant_stats(
+    tQuicStackHandler handler,
+    const tQuicServerCtx* server_ctx,
+    tQuicTenantStats* stats)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || stats == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  if (!stack->GetTenantStats(server_ctx, stats)) {
+    return QUIC_STACK_PARAMETER;
+  }
+  return QUIC_STACK_OK;
+}
+
 void quic_stack_add_on_can_write_callback_once(
     tQuicStackHandler handler,
     const tQuicRequestID* id,
@@ -719,3 +1608,16 @@ void quic_stack_add_on_can_write_callback_once(
 
   return stack->AddOnCanWriteCallback(*id, cb);
 }
+
+int quic_stack_get_stats(
+    tQuicStackHandler handler,
+    tQuicStackStats* stats)
+{
+  nginx::tQuicStack *stack = GET_THIS(handler);
+  if (stack == nullptr || stats == nullptr) {
+    return QUIC_STACK_PARAMETER;
+  }
+
+  stack->GetStats(stats);
+  return QUIC_STACK_OK;
+}
@@ -11,8 +11,13 @@
 #include "quic/core/crypto/quic_crypto_server_config.h"
 #include "quic/core/crypto/quic_random.h"
 #include "quic/core/proto/crypto_server_config_proto.h"
+#include "src/tQuicDeferredWriter.hh"
 #include "src/tQuicDispatcher.hh"
+#include "src/tQuicHeaderUtil.hh"
+#include "src/tQuicLog.hh"
+#include "src/tQuicPoller.hh"
 #include "src/tQuicServerStream.hh"
+#include "src/tQuicSharedCrypto.hh"
 #include "src/tQuicAlarmFactory.hh"
 #include "src/quic_stack_api.h"
 #include "src/tQuicClock.hh"
@@ -21,22 +26,36 @@ namespace nginx {
 
 class tQuicStack {
  public:
-  tQuicStack(tQuicStackContext stack_ctx,
-             tQuicRequestCallback cb,
-             tQuicClockTimeGenerator clock_gen,
-             uint32_t max_streams_per_connection,
-             uint64_t initial_idle_timeout_in_sec,
-             uint64_t default_idle_timeout_in_sec,
-             uint64_t max_idle_timeout_in_sec,
-             uint64_t max_time_before_crypto_handshake_in_sec,
-             uint8_t expected_connection_id_length);
+  // |opt| with its defaults applied, see ConfigWithDefaults.
+  explicit tQuicStack(const tQuicStackConfig& opt);
 
   ~tQuicStack();
 
+  // Copy of |opt| with the documented default of every unset field.
+  static tQuicStackConfig ConfigWithDefaults(const tQuicStackConfig& opt);
+
   void AddCertificate(const tQuicServerIdentify& qsi);
+  // Loads |qsis| in parallel and adds them in order, |loaded| tells which
+  // ones made it. Returns how many.
+  size_t AddCertificates(const std::vector<tQuicServerIdentify>& qsis,
+                         int threads,
+                         std::vector<bool>* loaded);
 
   void InitializeWithWriter(int fd, tQuicOnCanWriteCallback cb);
 
+  void SetWritableCallback(tQuicOnCanWriteCallback cb);
+
+  void SetSocketCallback(tQuicSocketCallback cb);
+
+  void SetConnectionCallback(tQuicConnectionCallback cb);
+
+  // Applies the runtime tunable fields of |opt|, see quic_stack_update_config.
+  void UpdateConfig(const tQuicStackConfig& opt);
+
+  tQuicLogger* logger() { return logger_.get(); }
+
+  bool AddWriter(int fd, const quic::QuicSocketAddress& self_addr);
+
   void ProcessBufferedChlos(size_t max_connections_to_create);
 
   void ProcessPacket(const quic::QuicSocketAddress& self_addr,
@@ -49,6 +68,9 @@ class tQuicStack {
 
   bool HasPendingWrites();
 
+  // Sends the packets held by the deferred writers.
+  void Flush();
+
   int ReadRequestBody(
     const tQuicRequestID& id,
     char* data,
@@ -71,6 +93,17 @@ class tQuicStack {
     size_t limit,
     bool fin);
 
+  // Raw upstream response passthrough, see quic_stack_write_upstream_response.
+  int WriteUpstreamResponse(
+    const tQuicRequestID& id,
+    const char* data,
+    size_t len,
+    bool eof,
+    int* complete);
+
+  // Recommended buffered bytes for the request, see quic_stack_buffer_target.
+  int BufferTarget(const tQuicRequestID& id, size_t* target);
+
   void CloseStream(const tQuicRequestID& id);
 
   void AddOnCanWriteCallback(
@@ -83,16 +116,51 @@ class tQuicStack {
   tQuicServerIdentify* GetServerIdentifyByName(const std::string& name);
   bool AddServerIdentify(const tQuicServerIdentify& qsi);
 
+  void GetStats(tQuicStackStats* stats);
+
+  bool SetPreferredAddress(const quic::QuicSocketAddress& address);
+  void ClearPreferredAddress();
+
+  void Drain(int64_t deadline_ms);
+
+  int SetStreamDeliveryRate(const tQuicRequestID& id,
+                            uint64_t rate_bps,
+                            uint64_t burst_bytes);
+  int SetConnectionDeliveryRate(const tQuicRequestID& id,
+                                uint64_t rate_bps,
+                                uint64_t burst_bytes);
+
+  // Pins the calling thread to |cpu| and its local NUMA node.
+  bool BindCpu(int cpu);
+
+  // Incoming CPU of |fd|, counted as a mismatch if not the bound CPU.
+  int SampleIncomingCpu(int fd);
+
+  // Busy polls the stack sockets for up to |budget_us|, returns the number
+  // of packets processed, 0 once idle.
+  int Poll(int64_t budget_us);
+
+  // Egress weight and cap of the tenant of |server_ctx|, NULL for the
+  // default one.
+  void SetTenantWeight(const tQuicServerCtx* server_ctx,
+                       uint32_t weight,
+                       uint64_t max_rate_bps);
+  bool GetTenantStats(const tQuicServerCtx* server_ctx, tQuicTenantStats* stats);
+
+  // Versions served by this stack, in order of preference.
+  quic::ParsedQuicVersionVector SupportedVersions();
+  bool gquic_enabled() const { return !disable_gquic_; }
+
  private:
   // Initialize the internal state of the stack.
   void Initialize();
   void InitializeConfigOptions(); 
-  // Generates a QuicServerConfigProtobuf protobuf suitable for
-  // QuicServAddConfig and SetConfigs in QuicCryptoServerConfig.
-  quic::QuicServerConfigProtobuf GenerateConfigProtobuf(
-    quic::QuicRandom* rand,
-    const quic::QuicClock* clock,
-    const quic::QuicCryptoServerConfig::ConfigOptions& options);
+  // Certificates loaded by the master, see tQuicSharedCrypto.
+  void AddSharedCertificates();
+
+  void ProcessPolledPacket(const quic::QuicSocketAddress& self_addr,
+                           const quic::QuicSocketAddress& peer_addr,
+                           char* buffer, size_t length);
 
   tQuicServerSession* GetSession(const tQuicRequestID& id);
   tQuicServerStream*  GetStream(const tQuicRequestID& id);
@@ -119,22 +187,86 @@ class tQuicStack {
 
   // The timeout before the handshake succeeds.
   uint32_t max_streams_per_connection_;
+  uint32_t max_unidirectional_streams_per_connection_;
+
+  // Request limit auto tuning of new connections, between a quarter of
+  // max_streams_per_connection_ and max_streams_per_connection_limit_.
+  bool max_streams_auto_tune_;
+  uint32_t max_streams_per_connection_limit_;
+  uint64_t max_open_streams_total_;
 
   // Maximum idle time before the crypto handshake is completed.
   uint64_t initial_idle_timeout_in_sec_;
-  // The default idle timeout.
-  uint64_t default_idle_timeout_in_sec_;
-  // The maximum idle timeout than can be negotiated.
+  // The maximum idle timeout than can be negotiated, the only one quiche
+  // knows, default_idle_timeout_in_sec of the config is not used.
   uint64_t max_idle_timeout_in_sec_;
   // Maximum time the session can be alive before crypto handshake is finished (should not be less than initial_idle_timeout_in_sec_).
   uint64_t max_time_before_crypto_handshake_in_sec_;
 
+  // Flow control windows advertised to clients.
+  uint32_t initial_stream_flow_control_window_;
+  uint32_t initial_session_flow_control_window_;
+
   // Connection ID length expected to be read on incoming IETF short headers.
   uint8_t expected_connection_id_length_;
 
+  // Serve IETF QUIC only, no SCFG is generated for the stack.
+  bool disable_gquic_;
+
+  // Connection lifetime before GOAWAY, zero for unlimited.
+  uint64_t max_connection_age_in_sec_;
+  // Time between GOAWAY and close for connections reaching max age.
+  uint64_t max_connection_age_grace_in_sec_;
+
+  // Send rate above which a connection moves to its own connected socket,
+  // zero to disable.
+  uint64_t connected_udp_threshold_bps_;
+
+  // SO_BUSY_POLL of the stack sockets, zero disables quic_stack_poll.
+  int busy_poll_us_;
+  // Reader of quic_stack_poll and its consecutive empty polls.
+  std::unique_ptr<tQuicPoller> poller_;
+  int empty_polls_;
+
+  // Egress of all connections is held until quic_stack_flush.
+  bool deferred_flush_;
+  // Writers of the stack sockets in that mode, owned by the dispatcher.
+  std::vector<tQuicDeferredWriter*> deferred_writers_;
+
+  // Whether write calls with limit 0 use the BDP based target, and its bounds.
+  bool adaptive_buffer_limit_;
+  uint64_t buffer_target_min_bytes_;
+  uint64_t buffer_target_max_bytes_;
+
+  // Pass the connection estimates to the host as x-quic-* request headers.
+  bool transport_info_headers_;
+
+  // Header names interned for every request, shared with the dispatcher.
+  tQuicHeaderNameTable header_names_;
+
+  // Stalled stream limits, zero disables the check.
+  uint64_t request_header_timeout_in_sec_;
+  uint64_t stream_progress_window_in_sec_;
+  uint64_t stream_min_progress_bytes_;
+
+  // New connections refused beyond these, zero is unlimited.
+  uint64_t max_connections_;
+  uint32_t max_connections_per_prefix_;
+  uint8_t  connection_prefix_len_v4_;
+  uint8_t  connection_prefix_len_v6_;
+
+  // Prepared SCFG and certificates, not owned, NULL if none.
+  const tQuicSharedCrypto* shared_crypto_;
+
   // Stack alarm events
   tQuicAlarmEventQueue*  quic_alarm_evq_;
 
+  // Stack counters, shared with the dispatcher.
+  tQuicStackStats        stats_;
+
+  // Stack logger, shared with the dispatcher and sessions.
+  std::unique_ptr<tQuicLogger> logger_;
+
 };
 
 }  // namespace nginx
@@ -0,0 +1,214 @@
+#include <algorithm>
+
+#include "quic/core/quic_connection.h"
+#include "quic/core/quic_constants.h"
+#include "src/tQuicServerSession.hh"
+#include "src/tQuicTenant.hh"
+
+using namespace quic;
+
+namespace nginx {
+
+const int64_t tQuicTenantScheduler::kQuantum = 16 * kMaxOutgoingPacketSize;
+
+tQuicTenant::tQuicTenant(const void* key)
+  : key(key),
+    weight(1),
+    max_rate(QuicBandwidth::Zero()),
+    deficit(0),
+    closed_bytes_sent(0),
+    closed_packets_sent(0),
+    blocked_writes(0)
+{
+}
+
+QuicBandwidth tQuicTenant::RateShare() const
+{
+  if (max_rate.IsZero() || sessions.empty()) {
+    return QuicBandwidth::Zero();
+  }
+  return QuicBandwidth::FromBitsPerSecond(
+    std::max<int64_t>(max_rate.ToBitsPerSecond() / sessions.size(), 1));
+}
+
+tQuicTenantScheduler::tQuicTenantScheduler()
+  : blocked_count_(0)
+{
+}
+
+tQuicTenantScheduler::~tQuicTenantScheduler() {}
+
+tQuicTenant* tQuicTenantScheduler::GetTenant(const void* key)
+{
+  auto it = tenants_.find(key);
+  if (it != tenants_.end()) {
+    return it->second.get();
+  }
+  tQuicTenant* tenant = new tQuicTenant(key);
+  tenants_[key].reset(tenant);
+  return tenant;
+}
+
+void tQuicTenantScheduler::Attach(tQuicServerSession* session)
+{
+  tQuicTenant* tenant = GetTenant(nullptr);
+  tenant->sessions.insert(session);
+  members_[session->connection()] = Member{session, tenant, false};
+  session->set_tenant(tenant);
+}
+
+void tQuicTenantScheduler::Assign(tQuicServerSession* session, const void* server_conf)
+{
+  auto it = members_.find(session->connection());
+  if (it == members_.end() || it->second.tenant->key == server_conf) {
+    return;
+  }
+
+  Member& member = it->second;
+  bool queued = member.queued;
+  Unqueue(member);
+  member.tenant->sessions.erase(session);
+
+  member.tenant = GetTenant(server_conf);
+  member.tenant->sessions.insert(session);
+  session->set_tenant(member.tenant);
+  if (queued) {
+    OnWriteBlocked(session->connection());
+  }
+}
+
+void tQuicTenantScheduler::Detach(tQuicServerSession* session)
+{
+  auto it = members_.find(session->connection());
+  if (it == members_.end()) {
+    return;
+  }
+
+  Member& member = it->second;
+  Unqueue(member);
+  const QuicConnectionStats& stats = session->connection()->GetStats();
+  member.tenant->closed_bytes_sent += stats.bytes_sent;
+  member.tenant->closed_packets_sent += stats.packets_sent;
+  member.tenant->sessions.erase(session);
+  session->set_tenant(nullptr);
+  members_.erase(it);
+}
+
+void tQuicTenantScheduler::SetWeight(const void* server_conf,
+                                     uint32_t weight,
+                                     QuicBandwidth max_rate)
+{
+  tQuicTenant* tenant = GetTenant(server_conf);
+  tenant->weight = weight > 0 ? weight : 1;
+  tenant->max_rate = max_rate;
+}
+
+bool tQuicTenantScheduler::OnWriteBlocked(QuicBlockedWriterInterface* writer)
+{
+  auto it = members_.find(writer);
+  if (it == members_.end()) {
+    return false;
+  }
+
+  // Connected UDP sockets are not shared, nothing to be fair about.
+  Member& member = it->second;
+  if (member.session->connected_udp()) {
+    return false;
+  }
+  if (member.queued) {
+    return true;
+  }
+  member.queued = true;
+  blocked_count_++;
+
+  tQuicTenant* tenant = member.tenant;
+  if (tenant->blocked.empty()) {
+    active_.push_back(tenant);
+  }
+  tenant->blocked.push_back(member.session);
+  return true;
+}
+
+void tQuicTenantScheduler::Unqueue(Member& member)
+{
+  if (!member.queued) {
+    return;
+  }
+  member.queued = false;
+  blocked_count_--;
+
+  tQuicTenant* tenant = member.tenant;
+  auto& blocked = tenant->blocked;
+  blocked.erase(std::find(blocked.begin(), blocked.end(), member.session));
+  if (blocked.empty()) {
+    tenant->deficit = 0;
+    // Not there while OnCanWrite is serving it.
+    auto active = std::find(active_.begin(), active_.end(), tenant);
+    if (active != active_.end()) {
+      active_.erase(active);
+    }
+  }
+}
+
+void tQuicTenantScheduler::OnCanWrite(const std::function<bool()>& writer_blocked)
+{
+  // Deficit round robin: every round a tenant may send its weight in
+  // quanta, what it did not use is kept while it has queued connections.
+  while (!active_.empty() && !writer_blocked()) {
+    tQuicTenant* tenant = active_.front();
+    active_.pop_front();
+    tenant->deficit += kQuantum * tenant->weight;
+
+    while (!tenant->blocked.empty() && tenant->deficit > 0) {
+      tQuicServerSession* session = tenant->blocked.front();
+      tenant->blocked.pop_front();
+      members_[session->connection()].queued = false;
+      blocked_count_--;
+
+      // Blocked again, the connection queues itself back at the end.
+      const QuicConnectionStats& stats = session->connection()->GetStats();
+      QuicByteCount sent_before = stats.bytes_sent;
+      session->connection()->OnBlockedWriterCanWrite();
+      tenant->deficit -= stats.bytes_sent - sent_before;
+      tenant->blocked_writes++;
+
+      if (writer_blocked()) {
+        break;
+      }
+    }
+
+    // OnWriteBlocked put the tenant back already if it became active
+    // again while emptied.
+    if (tenant->blocked.empty()) {
+      tenant->deficit = 0;
+    } else if (std::find(active_.begin(), active_.end(), tenant) == active_.end()) {
+      active_.push_back(tenant);
+    }
+  }
+}
+
+bool tQuicTenantScheduler::GetStats(const void* server_conf,
+                                    tQuicTenantStats* stats) const
+{
+  auto it = tenants_.find(server_conf);
+  if (it == tenants_.end()) {
+    return false;
+  }
+
+  const tQuicTenant* tenant = it->second.get();
+  stats->weight = tenant->weight;
+  stats->max_rate_bps = tenant->max_rate.ToBitsPerSecond();
+  stats->connections = tenant->sessions.size();
+  stats->blocked_connections = tenant->blocked.size();
+  stats->blocked_writes = tenant->blocked_writes;
+  stats->bytes_sent = tenant->closed_bytes_sent;
+  stats->packets_sent = tenant->closed_packets_sent;
+  for (tQuicServerSession* session : tenant->sessions) {
+    const QuicConnectionStats& conn_stats = session->connection()->GetStats();
+    stats->bytes_sent += conn_stats.bytes_sent;
+    stats->packets_sent += conn_stats.packets_sent;
+  }
+  return true;
+}
+
+}  // namespace nginx
@@ -0,0 +1,99 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack weighted fair egress across server contexts.
+
+#ifndef _NGINX_T_QUIC_TENANT_H_
+#define _NGINX_T_QUIC_TENANT_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+
+#include "quic/core/quic_bandwidth.h"
+#include "quic/core/quic_blocked_writer_interface.h"
+#include "src/quic_stack_api.h"
+
+namespace nginx {
+
+class tQuicServerSession;
+
+// Connections of one server context, keyed by its server_conf. Connections
+// belong to the default tenant (no server_conf) until their SNI is known.
+struct tQuicTenant {
+  explicit tQuicTenant(const void* key);
+
+  // Per connection share of max_rate, zero if uncapped.
+  quic::QuicBandwidth RateShare() const;
+
+  const void*                      key;
+  uint32_t                         weight;
+  quic::QuicBandwidth              max_rate;
+
+  std::set<tQuicServerSession*>    sessions;
+  // Write blocked connections, served in deficit round robin.
+  std::deque<tQuicServerSession*>  blocked;
+  int64_t                          deficit;
+
+  // Totals of the connections already closed.
+  uint64_t                         closed_bytes_sent;
+  uint64_t                         closed_packets_sent;
+  uint64_t                         blocked_writes;
+};
+
+// Serves write blocked connections across tenants in proportion to their
+// weights once the socket is writable again, so one tenant's burst can not
+// starve the others. Unblocked writes go out directly as before.
+class tQuicTenantScheduler {
+ public:
+  tQuicTenantScheduler();
+  tQuicTenantScheduler(const tQuicTenantScheduler&) = delete;
+  tQuicTenantScheduler& operator=(const tQuicTenantScheduler&) = delete;
+  ~tQuicTenantScheduler();
+
+  // A new connection, in the default tenant.
+  void Attach(tQuicServerSession* session);
+  // Moves |session| to the tenant of |server_conf| once its SNI is known.
+  void Assign(tQuicServerSession* session, const void* server_conf);
+  void Detach(tQuicServerSession* session);
+
+  // Zero weight resets to 1, zero max_rate removes the cap.
+  void SetWeight(const void* server_conf, uint32_t weight, quic::QuicBandwidth max_rate);
+
+  // Queues |writer| if it is one of our connections, false otherwise.
+  bool OnWriteBlocked(quic::QuicBlockedWriterInterface* writer);
+
+  // Serves the queued connections until none is left or |writer_blocked|
+  // turns true.
+  void OnCanWrite(const std::function<bool()>& writer_blocked);
+
+  bool HasPendingWrites() const { return blocked_count_ > 0; }
+
+  bool GetStats(const void* server_conf, tQuicTenantStats* stats) const;
+
+ private:
+  struct Member {
+    tQuicServerSession* session;
+    tQuicTenant*        tenant;
+    bool                queued;
+  };
+
+  tQuicTenant* GetTenant(const void* key);
+  void Unqueue(Member& member);
+
+  // Credit of a weight 1 tenant per round.
+  static const int64_t kQuantum;
+
+  std::map<const void*, std::unique_ptr<tQuicTenant>> tenants_;
+  std::unordered_map<quic::QuicBlockedWriterInterface*, Member> members_;
+  // Tenants with queued connections, in round robin order.
+  std::deque<tQuicTenant*> active_;
+  size_t                   blocked_count_;
+};
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_TENANT_H_
@@ -0,0 +1,115 @@
+#include "src/tQuicUpstreamParser.hh"
+
+namespace nginx {
+
+tQuicUpstreamParser::tQuicUpstreamParser(std::string* body, bool head_request)
+  : body_(body),
+    head_request_(head_request),
+    in_value_(false),
+    headers_complete_(false),
+    message_complete_(false),
+    status_code_(0)
+{
+  http_parser_init(&parser_, HTTP_RESPONSE);
+  parser_.data = this;
+
+  http_parser_settings_init(&settings_);
+  settings_.on_header_field     = OnHeaderField;
+  settings_.on_header_value     = OnHeaderValue;
+  settings_.on_headers_complete = OnHeadersComplete;
+  settings_.on_body             = OnBody;
+  settings_.on_message_complete = OnMessageComplete;
+}
+
+int tQuicUpstreamParser::Parse(const char* data, size_t len, bool eof)
+{
+  if (message_complete_) {
+    return 0;
+  }
+
+  size_t parsed = 0;
+  if (len > 0) {
+    parsed = http_parser_execute(&parser_, &settings_, data, len);
+    enum http_errno err = HTTP_PARSER_ERRNO(&parser_);
+    if (err == HPE_PAUSED) {
+      // Paused by OnMessageComplete, the rest is not part of the response.
+      return static_cast<int>(parsed);
+    }
+    if (err != HPE_OK) {
+      return -1;
+    }
+  }
+
+  if (eof) {
+    // Completes a body delimited by the connection close.
+    http_parser_execute(&parser_, &settings_, nullptr, 0);
+    if (!message_complete_) {
+      return -1;
+    }
+  }
+
+  return static_cast<int>(parsed);
+}
+
+int tQuicUpstreamParser::OnHeaderField(http_parser* parser, const char* at, size_t len)
+{
+  tQuicUpstreamParser* self = static_cast<tQuicUpstreamParser*>(parser->data);
+  HeaderList& fields = self->fields();
+  if (fields.empty() || self->in_value_) {
+    fields.emplace_back();
+    self->in_value_ = false;
+  }
+  fields.back().first.append(at, len);
+  return 0;
+}
+
+int tQuicUpstreamParser::OnHeaderValue(http_parser* parser, const char* at, size_t len)
+{
+  tQuicUpstreamParser* self = static_cast<tQuicUpstreamParser*>(parser->data);
+  HeaderList& fields = self->fields();
+  if (fields.empty()) {
+    return -1;
+  }
+  fields.back().second.append(at, len);
+  self->in_value_ = true;
+  return 0;
+}
+
+int tQuicUpstreamParser::OnHeadersComplete(http_parser* parser)
+{
+  tQuicUpstreamParser* self = static_cast<tQuicUpstreamParser*>(parser->data);
+  self->in_value_ = false;
+
+  // Interim response, wait for the final one. 101 is never expected as
+  // the upgrade was not asked for.
+  if (parser->status_code / 100 == 1) {
+    self->headers_.clear();
+    return 0;
+  }
+
+  self->status_code_ = parser->status_code;
+  self->headers_complete_ = true;
+  // 1 tells http_parser there is no body to read.
+  return self->head_request_ ? 1 : 0;
+}
+
+int tQuicUpstreamParser::OnBody(http_parser* parser, const char* at, size_t len)
+{
+  tQuicUpstreamParser* self = static_cast<tQuicUpstreamParser*>(parser->data);
+  self->body_->append(at, len);
+  return 0;
+}
+
+int tQuicUpstreamParser::OnMessageComplete(http_parser* parser)
+{
+  tQuicUpstreamParser* self = static_cast<tQuicUpstreamParser*>(parser->data);
+  if (!self->headers_complete_) {
+    return 0;
+  }
+
+  self->message_complete_ = true;
+  http_parser_pause(parser, 1);
+  return 0;
+}
+
+}  // namespace nginx
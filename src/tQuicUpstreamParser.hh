@@ -0,0 +1,67 @@
+// Copyright (c) 2019 Bilibili Video Cloud Team. All rights reserved.
+// Description: QUIC Stack incremental parser of upstream HTTP/1.1 responses.
+
+#ifndef _NGINX_T_QUIC_UPSTREAM_PARSER_H_
+#define _NGINX_T_QUIC_UPSTREAM_PARSER_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "http_parser/http_parser.h"
+
+namespace nginx {
+
+// Parses a raw HTTP/1.1 response as read from an upstream, in as many
+// pieces as it arrives. Interim 1xx responses are skipped, chunked framing
+// is removed and the body is appended to the caller's buffer.
+class tQuicUpstreamParser {
+ public:
+  typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+
+  // |body| receives the response body and must outlive the parser. A
+  // response to HEAD carries no body whatever its headers say.
+  tQuicUpstreamParser(std::string* body, bool head_request);
+  tQuicUpstreamParser(const tQuicUpstreamParser&) = delete;
+  tQuicUpstreamParser& operator=(const tQuicUpstreamParser&) = delete;
+
+  // Parses the next |len| bytes, |eof| once the upstream closed. Returns the
+  // number of bytes consumed, less than |len| only if the response ended
+  // before, or -1 if it is malformed or cut short.
+  int Parse(const char* data, size_t len, bool eof);
+
+  bool headers_complete() const { return headers_complete_; }
+  bool message_complete() const { return message_complete_; }
+
+  int status_code() const { return status_code_; }
+  const HeaderList& headers() const { return headers_; }
+  const HeaderList& trailers() const { return trailers_; }
+
+ private:
+  static int OnHeaderField(http_parser* parser, const char* at, size_t len);
+  static int OnHeaderValue(http_parser* parser, const char* at, size_t len);
+  static int OnHeadersComplete(http_parser* parser);
+  static int OnBody(http_parser* parser, const char* at, size_t len);
+  static int OnMessageComplete(http_parser* parser);
+
+  // Header fields go to headers_ until the head is done, then to trailers_.
+  HeaderList& fields() { return headers_complete_ ? trailers_ : headers_; }
+
+  http_parser          parser_;
+  http_parser_settings settings_;
+  std::string*         body_; // not owned
+  bool                 head_request_;
+
+  bool                 in_value_;
+  bool                 headers_complete_;
+  bool                 message_complete_;
+  int                  status_code_;
+  HeaderList           headers_;
+  HeaderList           trailers_;
+};
+
+}  // namespace nginx
+
+#endif  // _NGINX_T_QUIC_UPSTREAM_PARSER_H_
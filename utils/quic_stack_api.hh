@@ -22,6 +22,21 @@
 #define   QUIC_STACK_PARAMETER      -3
 #define   QUIC_STACK_STREAM_CLOSED  -4
 
+/* log levels */
+#define   QUIC_LOG_ERROR             0
+#define   QUIC_LOG_WARN              1
+#define   QUIC_LOG_INFO              2
+#define   QUIC_LOG_DEBUG             3
+
+/* log modules */
+#define   QUIC_LOG_MODULE_STACK      0
+#define   QUIC_LOG_MODULE_DISPATCHER 1
+#define   QUIC_LOG_MODULE_SESSION    2
+#define   QUIC_LOG_MODULE_STREAM     3
+#define   QUIC_LOG_MODULE_WRITER     4
+#define   QUIC_LOG_MODULE_CRYPTO     5
+#define   QUIC_LOG_MODULE_MAX        6
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -29,6 +44,7 @@ extern "C" {
 typedef void* tQuicStackHandler;
 typedef void* tQuicSessionHandler;
 typedef void* tQuicStreamHandler;
+typedef void* tQuicCryptoHandler;
 typedef void* tQuicStackContext;
 
 typedef struct {
@@ -39,6 +55,7 @@ typedef struct {
     socklen_t          self_socklen;
     struct sockaddr    *peer_sockaddr;
     socklen_t          peer_socklen;
+    void               *connection_ctx; // set by tQuicConnectionCallback.OnConnectionOpen
 } tQuicRequestID;
 
 struct tQuicServerCtx {
@@ -58,6 +75,11 @@ struct tQuicServerCtx {
                 void *ctx,
                 tQuicServerCtx *server_ctx);
    void    *server_conf;
+   /* NULL if the module is not interested in peer address changes */
+   int    (*on_request_address_change_impl)(
+                const tQuicRequestID *id,
+                void *ctx,
+                tQuicServerCtx *server_ctx);
 };
 
 typedef struct {
@@ -95,6 +117,17 @@ typedef struct {
                                 void *ctx,
                                 tQuicServerCtx *server_ctx);
 
+    /* OnRequestAddressChange
+       Called for every open request when the client migrated or was NAT
+       rebound to a new address, id carries the new peer address.
+       id: unique id for quic request
+       ctx: callback context
+    */
+    int                       (*OnRequestAddressChange)(
+                                const tQuicRequestID *id,
+                                void *ctx,
+                                tQuicServerCtx *server_ctx);
+
 } tQuicRequestCallback;
 
 typedef struct {
@@ -107,6 +140,165 @@ typedef struct tQuicOnCanWriteCallback {
     void                     *OnCanWriteContext;
 } tQuicOnCanWriteCallback;
 
+typedef struct tQuicSocketCallback {
+    /* OnSocketOpen
+       Called when the stack opened a socket connected to a single client,
+       the host reads it like its listening sockets and passes the packets
+       to quic_stack_process_packet.
+    */
+    void                     (*OnSocketOpen)(int fd, void* ctx);
+    /* OnSocketClose
+       Called before the stack closes a socket opened above.
+    */
+    void                     (*OnSocketClose)(int fd, void* ctx);
+    void                     *SocketContext;
+    /* OnSocketBlocked
+       Called when a socket opened above can not take more packets, the
+       host waits for it to be writable and calls quic_stack_on_can_write.
+       NULL if the host does not watch them, their connections then only
+       resume with the shared sockets.
+    */
+    void                     (*OnSocketBlocked)(int fd, void* ctx);
+} tQuicSocketCallback;
+
+typedef struct tQuicConnectionCallback {
+    /* OnConnectionOpen
+       Called when a connection is created, before any of its requests.
+       id: connection id and addresses, stream_id is 0
+       connection_ctx: set by the host, passed as id->connection_ctx to
+                       every request callback of the connection
+       Returning anything but QUIC_STACK_OK closes the connection.
+    */
+    int                       (*OnConnectionOpen)(
+                                const tQuicRequestID *id,
+                                void **connection_ctx,
+                                void *ctx);
+
+    /* OnHandshakeComplete
+       Called once the handshake is confirmed.
+       sni: server name sent by the client, may be empty
+       server_ctx: context of the certificate matching sni, or NULL
+    */
+    void                      (*OnHandshakeComplete)(
+                                const tQuicRequestID *id,
+                                const char *sni,
+                                size_t sni_len,
+                                tQuicServerCtx *server_ctx,
+                                void *connection_ctx,
+                                void *ctx);
+
+    /* OnConnectionClose
+       Called after the last OnRequestClose of the connection, the host
+       releases connection_ctx here. Not called for connections the host
+       rejected in OnConnectionOpen.
+    */
+    void                      (*OnConnectionClose)(
+                                const tQuicRequestID *id,
+                                void *connection_ctx,
+                                void *ctx);
+
+    void                     *ConnectionContext;
+} tQuicConnectionCallback;
+
+typedef struct tQuicLogCallback {
+    /* OnLog
+       Called from the stack logging thread, not the stack thread, with one
+       formatted line (no trailing newline, not NUL terminated).
+    */
+    void                     (*OnLog)(int module, int level, const char* msg, size_t len, void* ctx);
+    void                     *LogContext;
+} tQuicLogCallback;
+
+typedef struct tQuicStackStats {
+    /* writer */
+    uint64_t                    write_blocked_events;   // transitions into write blocked state
+    uint64_t                    write_blocked_total_us; // accumulated time spent write blocked
+    uint64_t                    write_blocked_max_us;   // longest single write blocked period
+    int                         write_blocked;          // 1 if writer is blocked right now
+
+    /* preferred address */
+    uint64_t                    preferred_address_advertised; // connections offered a preferred_address
+    uint64_t                    preferred_address_migrations; // connections moved to the preferred_address
+    uint64_t                    self_address_changes_rejected; // connections closed on other self address changes
+
+    /* peer address changes */
+    uint64_t                    peer_migrations;        // client moved to a new IP address
+    uint64_t                    peer_nat_rebindings;    // client port changed on the same IP address
+
+    /* draining */
+    uint64_t                    max_age_expired;        // connections that reached max connection age
+    uint64_t                    goaway_sent;            // connections told to go away
+    uint64_t                    streams_refused;        // new streams refused after GOAWAY
+    uint64_t                    drained_gracefully;     // draining connections closed after their last request
+    uint64_t                    drained_by_deadline;    // draining connections closed at the deadline
+
+    /* connected udp fast path */
+    uint64_t                    connected_udp_promotions; // connections moved to a connected socket
+    uint64_t                    connected_udp_demotions;  // connections moved back (migration or close)
+    uint64_t                    connected_udp_failures;   // connected sockets that could not be opened
+    uint64_t                    connected_udp_packets;    // packets sent on connected sockets
+    uint64_t                    connected_udp_syscalls;   // send calls made for them, packets - syscalls is the saving
+
+    /* deferred egress */
+    uint64_t                    deferred_flushes;         // quic_stack_flush calls that had packets to send
+    uint64_t                    deferred_early_flushes;   // flushes forced by a full writer before the call
+    uint64_t                    deferred_packets;         // packets sent by them
+    uint64_t                    deferred_syscalls;        // sendmmsg calls made for them
+    uint64_t                    deferred_send_errors;     // messages dropped on a send error
+
+    /* cpu placement */
+    int                         cpu;                      // CPU the stack is bound to, -1 if unbound
+    int                         numa_node;                // NUMA node of that CPU, -1 if unknown
+    uint64_t                    incoming_cpu_samples;     // quic_stack_incoming_cpu calls
+    uint64_t                    incoming_cpu_mismatches;  // samples where packets arrived on another CPU
+
+    /* busy polling */
+    uint64_t                    busy_poll_calls;          // quic_stack_poll calls that polled
+    uint64_t                    busy_poll_packets;        // packets read by them
+    uint64_t                    busy_poll_empty;          // calls that read nothing within their budget
+    uint64_t                    busy_poll_cpu_us;         // thread CPU time spent in them
+    int                         busy_poll_idle;           // 1 if back in interrupt mode right now
+
+    /* delivery rate limiting */
+    uint64_t                    rate_limited_streams;     // streams given a delivery rate
+    uint64_t                    rate_limited_connections; // connections given a delivery rate
+    uint64_t                    rate_limit_bytes_deferred; // response bytes of rate limited streams held past their burst
+
+    /* connection callbacks */
+    uint64_t                    connections_rejected;     // connections closed by OnConnectionOpen
+
+    /* connection limits */
+    uint64_t                    connections_refused_overload; // first packets answered with CONNECTION_CLOSE at max_connections
+    uint64_t                    connections_refused_prefix;   // same, at max_connections_per_prefix
+    uint64_t                    connection_prefixes;      // client prefixes with open connections
+
+    /* runtime config */
+    uint64_t                    config_updates;           // quic_stack_update_config calls
+
+    /* stream limits */
+    uint64_t                    open_streams;             // open requests right now
+    uint64_t                    streams_blocked_received; // STREAMS_BLOCKED frames for requests
+    uint64_t                    max_streams_target;       // request limit given to new connections
+
+    /* stalled stream reclamation */
+    uint64_t                    streams_reclaimed_header_timeout; // requests whose headers took longer than request_header_timeout_in_sec
+    uint64_t                    streams_reclaimed_slow_reader;    // responses below stream_min_progress_bytes per window
+
+    /* logging */
+    uint64_t                    log_dropped;              // lines lost to a full log ring
+    uint64_t                    log_suppressed;           // lines over the per site rate limit
+} tQuicStackStats;
+
+typedef struct tQuicTenantStats {
+    uint32_t                    weight;                   // egress share relative to the other tenants
+    uint64_t                    max_rate_bps;             // 0 if uncapped
+    uint64_t                    connections;              // open connections
+    uint64_t                    blocked_connections;      // connections waiting for the socket
+    uint64_t                    blocked_writes;           // turns given to blocked connections
+    uint64_t                    bytes_sent;               // including connections already closed
+    uint64_t                    packets_sent;
+} tQuicTenantStats;
+
 typedef struct tQuicStackCertificate {
     char                       *certificate;
     int                         certificate_len;
@@ -118,13 +310,52 @@ typedef struct tQuicStackCertificate {
 } tQuicStackCertificate;
 
 typedef struct tQuicStackConfig {
-    int                         max_streams_per_connection; // 100 by default
+    int                         max_streams_per_connection; // 100 by default, concurrent requests (bidirectional streams)
+    int                         max_unidirectional_streams_per_connection; // 8 by default, HTTP/3 clients need 3
+
+    int                         max_streams_auto_tune; // 0 by default, 1 adapts the request limit of new connections
+    int                         max_streams_per_connection_limit; // 4 * max_streams_per_connection by default, upper bound of the auto tuning
+    uint64_t                    max_open_streams_total; // 0 (no limit) by default, open requests of the stack above which new connections get lower limits
 
     int64_t                     initial_idle_timeout_in_sec; // 10 by default
-    int64_t                     default_idle_timeout_in_sec; // 60 by default
-    int64_t                     max_idle_timeout_in_sec; // 60*10 by default
+    int64_t                     default_idle_timeout_in_sec; // ignored, kept for compatibility, quiche negotiates a single idle timeout
+    int64_t                     max_idle_timeout_in_sec; // 60*10 by default, idle timeout offered to clients
     int64_t                     max_time_before_crypto_handshake_in_sec; // 15 by default
 
+    uint32_t                    initial_stream_flow_control_window; // 1MB by default
+    uint32_t                    initial_session_flow_control_window; // 16MB by default
+
+    int                         disable_gquic; // 0 by default, 1 serves IETF QUIC (TLS) versions only
+    int                         ietf_draft_versions; // 0 by default, 1 also serves the IETF drafts (h3-29) and T05x next to RFC v1/v2
+
+    int64_t                     max_connection_age_in_sec; // 0 (unlimited) by default, +/-10% jitter applied
+    int64_t                     max_connection_age_grace_in_sec; // 30 by default, time from GOAWAY to close
+
+    uint64_t                    connected_udp_threshold_bps; // 0 (disabled) by default, send rate moving a connection to its own connected socket
+
+    int                         busy_poll_us; // 0 (disabled) by default, SO_BUSY_POLL of the stack sockets, enables quic_stack_poll
+
+    int                         adaptive_buffer_limit; // 0 by default, 1 makes write_response_body with limit 0 use quic_stack_buffer_target
+    uint64_t                    buffer_target_min_bytes; // 64KB by default, lower bound of quic_stack_buffer_target
+    uint64_t                    buffer_target_max_bytes; // 4MB by default, upper bound of quic_stack_buffer_target
+
+    int                         transport_info_headers; // 0 by default, 1 adds x-quic-bw (bit/s), x-quic-rtt, x-quic-min-rtt (ms) and x-quic-loss (%) to request headers
+
+    const char                 *header_names; // NULL by default, comma separated header names interned next to the QPACK static table ones
+
+    int64_t                     request_header_timeout_in_sec; // 0 (disabled) by default, time a request may take to send its headers before it is reset
+    int64_t                     stream_progress_window_in_sec; // 0 (disabled) by default, window over which a response with pending data must make progress
+    uint64_t                    stream_min_progress_bytes; // 1 by default, bytes such a response must deliver per window, reset otherwise
+
+    uint64_t                    max_connections; // 0 (no limit) by default, connections of the stack beyond which new ones are refused before their handshake
+    uint32_t                    max_connections_per_prefix; // 0 (no limit) by default, same per client prefix
+    int                         connection_prefix_len_v4; // 32 by default, prefix length grouping IPv4 clients
+    int                         connection_prefix_len_v6; // 64 by default, prefix length grouping IPv6 clients
+
+    int                         deferred_flush; // 0 by default, 1 holds the packets of all connections until quic_stack_flush
+
+    tQuicCryptoHandler          shared_crypto; // NULL by default, from quic_stack_crypto_create, its SCFG and certificates are used instead of per stack ones
+
     tQuicStackContext           stack_ctx;
 
     tQuicRequestCallback        req_cb;
@@ -140,12 +371,131 @@ typedef struct tQuicStackConfig {
 EXPORT_API
 tQuicStackHandler quic_stack_create(const tQuicStackConfig* opt_ptr);
 
+/* quic_stack_update_config
+   Retunes a running stack from a full config, as passed to
+   quic_stack_create, without resetting its connections.
+   - stream limits and their auto tuning, idle and handshake timeouts and
+     flow control windows apply to new connections, zero or negative values
+     keep the current ones, max_open_streams_total and max_streams_auto_tune
+     are applied as given. Established connections also take a new max_idle_timeout_in_sec,
+     capped to the value negotiated with the client. Their MAX_STREAMS and
+     flow control windows stay as negotiated. default_idle_timeout_in_sec
+     is ignored, as by quic_stack_create.
+   - max_connection_age_*, connected_udp_threshold_bps,
+     transport_info_headers, adaptive_buffer_limit and buffer_target_* are
+     applied as given, for new connections and requests.
+   - request_header_timeout_in_sec and stream_progress_* are applied as
+     given, to open requests as well.
+   - max_connections and max_connections_per_prefix are applied as given,
+     connection_prefix_len_* only when positive, to new connections.
+   - disable_gquic, ietf_draft_versions, busy_poll_us, deferred_flush, header_names,
+     shared_crypto, contexts, callbacks and the clock are fixed at creation
+     and ignored here.
+   CHLO budgets are the max_connection_to_create argument of
+   quic_stack_process_chlos and can change on every call already.
+*/
+EXPORT_API
+int quic_stack_update_config(tQuicStackHandler handler, const tQuicStackConfig* opt_ptr);
+
 EXPORT_API
 void quic_stack_add_certificate(tQuicStackHandler handler, const tQuicStackCertificate* cert_ptr);
 
+/* quic_stack_add_certificates
+   Bulk quic_stack_add_certificate. The cert_num certificates are read,
+   parsed and checked against their keys on up to threads threads (0 for
+   one per CPU), then added in array order so a later one still wins a
+   name shared with an earlier one. A failing certificate does not stop
+   the batch: results, if not NULL, gets QUIC_STACK_OK, QUIC_STACK_PARAMETER
+   for an incomplete entry or QUIC_STACK_SERVER for one that failed to load.
+   Returns the number of certificates added, QUIC_STACK_PARAMETER on bad
+   arguments.
+*/
+EXPORT_API
+int quic_stack_add_certificates(
+    tQuicStackHandler handler,
+    const tQuicStackCertificate* certs,
+    int cert_num,
+    int threads,
+    int* results);
+
+/* quic_stack_crypto_create
+   Generates the SCFG and loads cert_num certificates once, in parallel as
+   quic_stack_add_certificates does with one thread per CPU, meant to be
+   called by the master process before it forks the workers. Stacks created
+   with it as shared_crypto take both from it, quic_stack_add_certificate is
+   still possible for certificates added later. Nothing in it is written
+   after this call, so the workers share its memory copy-on-write.
+   Certificates failing to load are skipped, results, if not NULL, gets
+   their status as with quic_stack_add_certificates.
+   The handler must outlive every stack using it.
+*/
+EXPORT_API
+tQuicCryptoHandler quic_stack_crypto_create(
+    const tQuicStackCertificate* certs,
+    int cert_num,
+    int* results);
+
+EXPORT_API
+void quic_stack_crypto_release(tQuicCryptoHandler crypto);
+
 EXPORT_API
 void quic_stack_init_writer(tQuicStackHandler handler, int sockfd, tQuicOnCanWriteCallback write_blocked_cb);
 
+/* quic_stack_add_writer
+   Adds a socket bound to self_saddr (a wildcard address matches any local
+   address of its family and port). Connections whose local address matches
+   send through it with their own batch buffer, everything else goes through
+   the socket of quic_stack_init_writer. quic_stack_on_can_write retries all
+   sockets, so the host should arm EPOLLOUT on all of them when blocked.
+*/
+EXPORT_API
+int quic_stack_add_writer(
+    tQuicStackHandler handler,
+    int sockfd,
+    const struct sockaddr* self_saddr,
+    socklen_t self_len);
+
+/* quic_stack_set_socket_callback
+   Required by the connected UDP fast path (connected_udp_threshold_bps),
+   without it connections always stay on the listening sockets.
+*/
+EXPORT_API
+void quic_stack_set_socket_callback(tQuicStackHandler handler, tQuicSocketCallback socket_cb);
+
+/* quic_stack_set_connection_callback
+   Enables the connection lifecycle callbacks, so per client work (SNI
+   config lookup, geo-IP, auth, rate-limit bucket) is done once per
+   connection and shared by its requests through id->connection_ctx.
+*/
+EXPORT_API
+void quic_stack_set_connection_callback(tQuicStackHandler handler, tQuicConnectionCallback conn_cb);
+
+/* quic_stack_set_log_file / quic_stack_set_log_callback
+   Sinks of the stack logger. Lines are queued in a lock-free ring by the
+   stack thread and written by a background thread, so a slow sink never
+   stalls the event loop; lines logged before a sink is set are kept.
+*/
+EXPORT_API
+int quic_stack_set_log_file(tQuicStackHandler handler, const char* path);
+
+EXPORT_API
+void quic_stack_set_log_callback(tQuicStackHandler handler, tQuicLogCallback log_cb);
+
+/* quic_stack_set_log_level
+   Sets the verbosity (QUIC_LOG_*) of module (QUIC_LOG_MODULE_*), or of
+   every module when module is -1, at any time. QUIC_LOG_WARN by default.
+*/
+EXPORT_API
+void quic_stack_set_log_level(tQuicStackHandler handler, int module, int level);
+
+/* quic_stack_set_writable_callback
+   write_blocked_cb passed to quic_stack_init_writer is called once when the
+   writer turns blocked, writable_cb is called once when it turns writable
+   again, so the host only needs to arm EPOLLOUT between the two edges.
+*/
+EXPORT_API
+void quic_stack_set_writable_callback(tQuicStackHandler handler, tQuicOnCanWriteCallback writable_cb);
+
 EXPORT_API
 void quic_stack_process_chlos(tQuicStackHandler handler, size_t max_connection_to_create);
 
@@ -159,6 +509,18 @@ void quic_stack_process_packet(
 EXPORT_API
 void quic_stack_on_can_write(tQuicStackHandler handler);
 
+/* quic_stack_flush
+   With deferred_flush the stack sockets send nothing while packets and
+   alarms are processed. The host calls this once at the end of each event
+   loop iteration, and the packets of all connections go out in a few
+   sendmmsg calls, packets to the same destination as one UDP GSO message.
+   If a socket turns blocked, the rest is kept and the write blocked
+   callback fires; flush again after quic_stack_on_can_write. No-op
+   without deferred_flush.
+*/
+EXPORT_API
+void quic_stack_flush(tQuicStackHandler handler);
+
 EXPORT_API
 int quic_stack_has_chlos_buffered(tQuicStackHandler handler);
 
@@ -182,6 +544,17 @@ int quic_stack_write_response_header(
     size_t trailers_len,
     int last);
 
+/* quic_stack_write_response_body
+   Appends up to len bytes of data to the response, last ends it once all
+   of data is taken. Returns the number of bytes taken.
+   Without a limit the body is held and sent at last with its length.
+   With a limit, or adaptive_buffer_limit and limit 0, the body is sent as
+   it comes, with the content-length given by the host if any, and no more
+   than limit bytes are held for the request: fewer bytes are taken while
+   the send buffer is full, the host then waits for the callback of
+   quic_stack_add_on_can_write_callback_once. Bodies of rate limited
+   requests are held until last, the limit only bounds their send buffer.
+*/
 EXPORT_API
 int quic_stack_write_response_body(
     tQuicStackHandler handler,
@@ -193,6 +566,27 @@ int quic_stack_write_response_body(
     size_t limit,
     int last);
 
+/* quic_stack_write_upstream_response
+   Passthrough for proxied requests, instead of write_response_header and
+   write_response_body: hands the stack the raw HTTP/1.1 response bytes read
+   from the upstream, in as many calls as they arrive. The stack parses the
+   status line, headers, chunked framing and trailers, drops hop-by-hop
+   headers and sends the response once complete. Pass eof = 1 when the
+   upstream closed, it ends responses delimited by the connection close.
+   Returns the number of bytes consumed, fewer than len only when the
+   response ended before, and sets *complete (if not NULL) once the
+   response is sent. Returns QUIC_STACK_SERVER for a malformed or truncated
+   response, the host should then reset the request.
+*/
+EXPORT_API
+int quic_stack_write_upstream_response(
+    tQuicStackHandler handler,
+    const tQuicRequestID* id,
+    const char* data,
+    size_t len,
+    int eof,
+    int* complete);
+
 EXPORT_API
 void quic_stack_close_stream(
     tQuicStackHandler handler,
@@ -206,18 +600,181 @@ void quic_stack_on_alarm_timeout(
     tQuicStackHandler handler,
     int64_t deadline_ms);
 
+/* quic_stack_supported_versions
+   Writes the gQUIC versions served by the stack as a comma separated list
+   of version numbers, for the legacy quic= Alt-Svc parameter. Empty with
+   disable_gquic, quic_stack_alt_svc covers IETF QUIC.
+   Returns the list length, or QUIC_STACK_SERVER if buf is too small.
+*/
 EXPORT_API
 int quic_stack_supported_versions(
     tQuicStackHandler handler,
     char* buf,
     size_t len);
 
+/* quic_stack_alt_svc
+   Writes an Alt-Svc header value advertising every enabled version, IETF
+   QUIC v1/v2 (h3) first, e.g. h3=":443"; ma=86400, h3-29=":443"; ma=86400
+   h3-29 only with ietf_draft_versions, h3-Q0xx only without disable_gquic.
+   Returns the value length, or QUIC_STACK_SERVER if buf is too small.
+*/
+EXPORT_API
+int quic_stack_alt_svc(
+    tQuicStackHandler handler,
+    uint16_t port,
+    uint32_t max_age_in_sec,
+    char* buf,
+    size_t len);
+
+/* quic_stack_set_preferred_address
+   Advertises addr as the preferred_address transport parameter to new
+   IETF QUIC connections (one address per family), so clients move to an
+   address that the host routes to a less loaded worker sharing the same
+   connection ID routing. Clients arriving on it are accepted as migrations.
+   Passing addr == NULL withdraws the advertisement for both families.
+*/
+EXPORT_API
+int quic_stack_set_preferred_address(
+    tQuicStackHandler handler,
+    const struct sockaddr* addr,
+    socklen_t len);
+
+/* quic_stack_drain
+   Sends GOAWAY on every connection, lets in-flight requests finish and
+   refuses new ones, then closes each connection after its last request or
+   at deadline_ms (same clock as quic_stack_next_alarm_time) at the latest.
+   Connections created afterwards are drained right away.
+*/
+EXPORT_API
+void quic_stack_drain(
+    tQuicStackHandler handler,
+    int64_t deadline_ms);
+
+/* quic_stack_buffer_target
+   Sets target to the buffered bytes worth keeping for request id, twice
+   the bandwidth-delay product of its connection bounded by
+   buffer_target_min_bytes/buffer_target_max_bytes, to be used as the limit
+   of quic_stack_write_response_body. It follows the connection estimates,
+   so query it again on each write.
+*/
+EXPORT_API
+int quic_stack_buffer_target(
+    tQuicStackHandler handler,
+    const tQuicRequestID* id,
+    size_t* target);
+
+/* quic_stack_set_stream_rate_limit
+   Delivers the response body of request id at rate_bps at most once
+   burst_bytes have been sent, e.g. 1.5x the media bitrate after a few
+   seconds of media. The stack holds the rest of the body and hands it to
+   the connection progressively, the host keeps writing as usual.
+   rate_bps == 0 removes the limit. Call it before the last body write.
+*/
+EXPORT_API
+int quic_stack_set_stream_rate_limit(
+    tQuicStackHandler handler,
+    const tQuicRequestID* id,
+    uint64_t rate_bps,
+    uint64_t burst_bytes);
+
+/* quic_stack_set_connection_rate_limit
+   Caps the pacing rate of the connection carrying request id to rate_bps
+   once burst_bytes more bytes have been sent on it, for every request of
+   the connection. rate_bps == 0 removes the cap.
+*/
+EXPORT_API
+int quic_stack_set_connection_rate_limit(
+    tQuicStackHandler handler,
+    const tQuicRequestID* id,
+    uint64_t rate_bps,
+    uint64_t burst_bytes);
+
+/* quic_stack_poll
+   Busy polls the sockets given to quic_stack_init_writer/quic_stack_add_writer
+   with recvmmsg for at most budget_us and processes the packets read, so
+   latency sensitive listeners do not wait for an epoll wakeup. Requires
+   busy_poll_us and IP_PKTINFO/IPV6_PKTINFO on wildcard bound sockets.
+   Returns the number of packets processed. It returns 0 right away while
+   the stack has no connection or after a few empty polls: the host then
+   goes back to epoll, and the next packet it passes to
+   quic_stack_process_packet re-enables polling.
+*/
+EXPORT_API
+int quic_stack_poll(
+    tQuicStackHandler handler,
+    int64_t budget_us);
+
+/* quic_stack_incoming_cpu
+   Returns the CPU that received the last packet on sockfd (SO_INCOMING_CPU),
+   or -1 if the kernel does not report it. Once the stack is bound, calls
+   are counted in incoming_cpu_samples/incoming_cpu_mismatches, so sampling
+   it every few reads shows how cache-local packet processing is.
+   handler may be NULL to query a socket before the stack exists.
+*/
+EXPORT_API
+int quic_stack_incoming_cpu(
+    tQuicStackHandler handler,
+    int sockfd);
+
+/* quic_stack_bind_cpu
+   Pins the calling thread (the one driving the stack) to cpu and makes its
+   future allocations, including packet and stream buffer pools, prefer
+   the NUMA node of that CPU. Call it right after quic_stack_create, before
+   traffic, typically with the CPU the NIC queue of the worker's socket
+   interrupts (see quic_stack_incoming_cpu).
+*/
+EXPORT_API
+int quic_stack_bind_cpu(
+    tQuicStackHandler handler,
+    int cpu);
+
+/* quic_stack_attach_reuseport_cpu_filter
+   Steers each packet of a SO_REUSEPORT group to the socket whose index
+   equals the CPU that received it. Call it once on any socket of the group
+   after all of them are bound, sockets being bound in CPU order with one
+   worker bound to each CPU; packets received on CPUs without a socket
+   fall back to the kernel hash.
+*/
+EXPORT_API
+int quic_stack_attach_reuseport_cpu_filter(int sockfd);
+
+/* quic_stack_set_tenant_weight
+   Connections are grouped in tenants by the server_conf of the certificate
+   matching their SNI, connections without a match and those still in the
+   handshake belong to the default tenant (server_ctx NULL). When the
+   socket is blocked, the waiting connections get to send in proportion to
+   the weight of their tenant (1 by default) once it is writable again.
+   max_rate_bps caps the tenant egress, split evenly over its connections
+   through their pacing rate, 0 removes the cap.
+*/
+EXPORT_API
+int quic_stack_set_tenant_weight(
+    tQuicStackHandler handler,
+    const tQuicServerCtx* server_ctx,
+    uint32_t weight,
+    uint64_t max_rate_bps);
+
+/* quic_stack_get_tenant_stats
+   Counters of the tenant of server_ctx (NULL for the default one), returns
+   QUIC_STACK_PARAMETER for a tenant without connections or weight yet.
+*/
+EXPORT_API
+int quic_stack_get_tenant_stats(
+    tQuicStackHandler handler,
+    const tQuicServerCtx* server_ctx,
+    tQuicTenantStats* stats);
+
 EXPORT_API
 void quic_stack_add_on_can_write_callback_once(
     tQuicStackHandler handler,
     const tQuicRequestID* id,
     tQuicOnCanWriteCallback cb);
 
+EXPORT_API
+int quic_stack_get_stats(
+    tQuicStackHandler handler,
+    tQuicStackStats* stats);
+
 
 #ifdef __cplusplus
 }